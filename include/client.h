@@ -24,6 +24,23 @@ namespace evpp {
 }
 
 namespace influxdb {
+    class admission_queue;
+
+    class circuit_breaker;
+
+    class retry_budget;
+
+    /**
+     * Receives a response body chunk by chunk, see client::queryStream().
+     * begin() is called before the first chunk of every attempt and must drop whatever a previous (failed) attempt
+     * delivered. end() is called after the last chunk and may throw.
+     */
+    struct stream_handler {
+        std::function<void()> begin;
+        std::function<void(const char *, size_t)> chunk;
+        std::function<void()> end;
+    };
+
     typedef std::function<std::string(const std::unordered_map<std::string, std::string> &tags)> TagsKeyFunc;
 
     using namespace std::chrono_literals;
@@ -31,15 +48,52 @@ namespace influxdb {
     constexpr int RequestTimeoutSeconds = 60 * 4;
     constexpr auto DefaultBatchTime = 48h;
     constexpr size_t DefaultConnPoolSize = 10;
+    constexpr size_t MaxQueuedRequests = 1u << 16u;
+    constexpr int FetchRetryBudget = 32;
+    constexpr int CircuitBreakerThreshold = 5;
+    constexpr auto CircuitBreakerCooldown = 10s;
+
+    /**
+     * Wire format of query responses. InfluxDB >= 1.4 can answer with MessagePack, which is smaller and much cheaper
+     * to decode (fixed-width binary timestamps and floats), or with CSV, which has the least overhead per row.
+     */
+    enum class response_format {
+        json, msgpack, csv
+    };
+
+    /**
+     * Which entries a size-bounded cache drops first: least recently or least frequently read ones.
+     */
+    enum class cache_eviction {
+        lru, lfu
+    };
+
+    /**
+     * Bounds of a cache directory, see client::setCacheLimits().
+     */
+    struct cache_limits {
+        uint64_t maxBytes = 0; // 0 = unbounded
+        cache_eviction eviction = cache_eviction::lru;
+        bool compact = true; // pack the small batch files of a query into segment files
+    };
 
     class client {
         std::unique_ptr<evpp::EventLoopThread> t;
         std::unique_ptr<evpp::httpc::ConnPool> pool;
+        std::string server;
         std::string dbName;
         std::chrono::milliseconds batchTime;
 
         size_t connPoolSize;
-        std::atomic<int> numPendingReq{0};
+        std::unique_ptr<admission_queue> admission;
+        std::unique_ptr<circuit_breaker> breaker;
+        response_format format{response_format::json};
+        size_t chunkSize = 0;
+        std::string cacheDir{};
+        bool cacheCompress = false;
+        std::unique_ptr<cache_limits> cacheLimits{};
+
+        std::string cacheKey(const std::string &kind, const std::string &sql) const;
 
     public:
         client(const std::string &host, int port, const std::string &dbName,
@@ -47,6 +101,43 @@ namespace influxdb {
 
         ~client();
 
+        /**
+         * Limit the number of in-flight requests of all clients in this process (0 = no limit).
+         * The per-client limit is connPoolSize.
+         */
+        static void setGlobalConcurrencyLimit(size_t limit);
+
+        /**
+         * Response format used by fetch() and queryStream(). query() and queryTags() always use JSON.
+         */
+        void setResponseFormat(response_format f) { format = f; }
+
+        response_format responseFormat() const { return format; }
+
+        /**
+         * Let the server stream fetch() and queryStream() responses in chunks of at most n rows (chunked=true&chunk_size=n), 0 = off.
+         * Each chunk is decoded as it arrives, so batchTime can be much larger without holding whole responses.
+         */
+        void setChunkSize(size_t n) { chunkSize = n; }
+
+        /**
+         * Persist the results of fetch() and fetchGroups() batches under `dir` (empty = off), keyed on server,
+         * database and batch query. Batches that end more than a minute ago are immutable and read from the cache,
+         * more recent ones always go to the server. fetch() maps cache hits and copies them from the file straight
+         * into the result. With `compress`, entries are gorilla encoded instead, typically 5-10x smaller for regularly
+         * sampled data, but decoded on every hit.
+         */
+        void setCacheDir(const std::string &dir, bool compress = false) {
+            cacheDir = dir;
+            cacheCompress = compress;
+        }
+
+        /**
+         * Keeps the cache directory within `limits.maxBytes`, evicting whole batch and segment files, and packs the
+         * batch files of a query into larger segment files (fewer inodes). Runs on a background thread per directory
+         * from the next fetch() on, readers are not blocked.
+         */
+        void setCacheLimits(const cache_limits &limits) { cacheLimits = std::make_unique<cache_limits>(limits); }
 
         typedef influxdb::fetchResult fetchResult;
         typedef influxdb::series series;
@@ -73,8 +164,28 @@ namespace influxdb {
             return queryTags(sql, {args.begin(), args.end()});
         }
 
-        std::future<void> queryRaw(const std::string &sql, std::function<void(const char *, size_t)> &&callback);
+        /**
+         * Sends the query asynchronously. Transient errors (5xx, 429, connection failures) are retried with jittered
+         * exponential backoff on event loop timers, taking one retry from `budget` each (if given).
+         * Fails fast while the server is considered down (circuit breaker open).
+         * With chunkSize > 0 the server streams the result in chunks of at most chunkSize rows and `callback` is
+         * called with each chunk (a complete JSON document) as it arrives. A retried request delivers its chunks again.
+         */
+        std::future<void> queryRaw(const std::string &sql, std::function<void(const char *, size_t)> &&callback,
+                                   const std::shared_ptr<retry_budget> &budget = nullptr, size_t chunkSize = 0);
+
+        /**
+         * Like queryRaw(), but hands the response body to `handler` in chunks as they arrive from the network
+         * instead of buffering it. The body is in the client's response format (see setResponseFormat()).
+         */
+        std::future<void> queryStream(const std::string &sql, stream_handler &&handler,
+                                      const std::shared_ptr<retry_budget> &budget = nullptr);
 
+        /**
+         * Like fetch() for a query with GROUP BY tags: returns one series per group, keyed by keyFunc(tags).
+         * Batches are requested and parsed in parallel, groups are merged concurrently. If a batch fails, the first
+         * exception is rethrown after all batches completed.
+         */
         auto fetchGroups(const std::string &sql, std::array<std::string, 2> timeRange,
                          const std::vector<std::string> &&args, const TagsKeyFunc &keyFunc)
         -> std::unordered_map<std::string, series>;
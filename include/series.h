@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -9,19 +11,102 @@
 
 namespace influxdb {
     struct series;
+    struct series_view;
     struct SeriesReader;
     struct DataReader;
+    struct FetchReader;
+    class FastFetchReader;
+
+    class CsvFetchReader;
 
     static std::istream &operator>>(std::istream &s, series &fr);
 
+    /**
+     * How series::fillTimeGaps() fills missing frames: repeat the previous row, a constant, or linear interpolation
+     * between the rows around the gap.
+     */
+    enum class fill_mode {
+        previous, constant, linear
+    };
+
+    /**
+     * Which values series::sortedMerge() keeps for a timestamp present in several inputs: the row of the first or the
+     * last input (in vector order), or per column the first non-NaN value.
+     */
+    enum class dedup_policy {
+        first, last, preferValid
+    };
+
+    /**
+     * series::join() semantics. inner: timestamps present in all inputs. leftOuter: timestamps of the first input,
+     * NaN where another input has no row at that time. asOf: timestamps of the first input, other inputs contribute
+     * their latest row at or before that time (if not older than the tolerance), NaN otherwise.
+     */
+    enum class join_mode {
+        inner, leftOuter, asOf
+    };
+
+    /**
+     * Per-column aggregate of series::resample(). NaN values are skipped (first/last take the first/last row of the
+     * bucket as is), a bucket without valid values yields NaN (count: 0).
+     */
+    enum class aggregator {
+        mean, min, max, first, last, sum, count
+    };
+
+    /**
+     * Per-column function of series::rolling() / rolling_window. NaN values are skipped, stddev is the sample
+     * standard deviation. A window without (enough) valid values yields NaN.
+     */
+    enum class window_fn {
+        sum, mean, min, max, stddev
+    };
+
+    /**
+     * Extent of a rolling window ending at the current row: the rows within `duration` (t > now - duration) or
+     * the last `rows` rows.
+     */
+    struct window_size {
+        int64_t duration;
+        size_t rows;
+
+        static window_size byTime(int64_t duration) { return {duration, 0}; }
+
+        static window_size byCount(size_t rows) { return {0, rows}; }
+    };
+
+    /**
+     * Zero-copy view of one value column of a series, contiguous (stride 1) if the series is columnar.
+     */
+    template<class T>
+    struct column_view {
+        T *ptr;
+        size_t stride;
+        size_t size;
+
+        inline T &operator[](size_t row) const { return ptr[row * stride]; }
+
+        inline bool contiguous() const { return stride == 1; }
+    };
+
     struct series {
         friend struct SeriesReader;
         friend struct DataReader;
+        friend struct FetchReader;
+        friend class FastFetchReader;
+        friend class CsvFetchReader;
+        friend class rolling_window;
+        friend struct series_view;
 
         friend std::istream &operator>>(std::istream &s, series &fr);
+        friend void writeSeries(std::ostream &s, const series &fr, bool compress);
+        friend void readSeries(std::istream &s, series &fr);
+        friend class mapped_series;
 
         std::string name{};
         std::unordered_map<std::string, std::string> tags{};
+        // interned tags (see tag_dict), filled instead of `tags` by readers given a dictionary
+        std::vector<uint32_t> tagIds{};
         std::vector<std::string> columns{};
         size_t num{0};
         size_t dataStride{0};
@@ -29,18 +114,91 @@ namespace influxdb {
     private:
         std::vector<int64_t> time{};
 
-    public:
+        // compact time (tInterval != 0): t(i) = tStart + i * tInterval. The grid restarts at the rows in tSegments
+        // (after a gap or an off-grid sample): t(i) = time + (i - row) * tInterval for the last (row, time) <= i
+        int64_t tStart{0};
+        int64_t tInterval{0};
+        std::vector<std::pair<size_t, int64_t>> tSegments{};
+
+        int64_t tSegmented(size_t frame) const;
+
+        void sliceTime(size_t start, size_t count);
 
-        inline std::vector<int64_t> &getTimeVector() { return time; }
+        // data is column-major: value column c is data[c * num, (c + 1) * num)
+        bool columnar{false};
 
-        inline const std::vector<int64_t> &getTimeVector() const { return time; }
+        void eraseRows(size_t start, size_t count);
+
+        size_t fillForwardFrom(size_t row);
+
+        static series kWayMerge(std::vector<series> &results, dedup_policy policy);
+
+        // name, tags and columns of the binary format
+        static void parseFileMeta(const char *p, size_t len, series &fr);
+
+    public:
+
+        /**
+         * Copy of the timestamps as a dense vector, compact time stays compact and nothing is kept. To only read
+         * them, t(i) or a series_view avoid the copy.
+         */
+        std::vector<int64_t> timeVector() const;
+
+        /**
+         * Same as timeVector(), returns a copy (the const overload used to return a reference to dense time).
+         */
+        inline std::vector<int64_t> getTimeVector() const { return timeVector(); }
+
+        /**
+         * Mutable dense time vector, to build or modify time. Switches compact time back to dense (expandTime()), use
+         * timeVector() to only read it.
+         */
+        inline std::vector<int64_t> &getTimeVector() {
+            expandTime();
+            return time;
+        }
 
         inline void clear() {
             data.clear();
             time.clear();
+            tInterval = 0;
+            tSegments.clear();
+            columnar = false;
             num = 0;
         }
 
+        inline bool isColumnar() const { return columnar; }
+
+        /**
+         * Transposes data to one contiguous array per value column (structure of arrays). Per column operations
+         * (aggregates, fill, projections) then run on contiguous memory. All series operations support both
+         * layouts, readers and fetch() produce row-major series.
+         */
+        void toColumnar();
+
+        void toRowMajor();
+
+        inline float &at(size_t row, size_t col) {
+            return columnar ? data[col * num + row] : data[row * dataStride + col];
+        }
+
+        inline float at(size_t row, size_t col) const {
+            return columnar ? data[col * num + row] : data[row * dataStride + col];
+        }
+
+        /**
+         * Value column `col` (0 is the first column after time).
+         */
+        inline column_view<float> column(size_t col) {
+            return columnar ? column_view<float>{data.data() + col * num, 1, num}
+                            : column_view<float>{data.data() + col, dataStride, num};
+        }
+
+        inline column_view<const float> column(size_t col) const {
+            return columnar ? column_view<const float>{data.data() + col * num, 1, num}
+                            : column_view<const float>{data.data() + col, dataStride, num};
+        }
+
 
         void erase(size_t start, size_t count);
 
@@ -48,50 +206,133 @@ namespace influxdb {
 
         decltype(time.begin()) insert(size_t start, size_t count);
 
-        inline int64_t t(size_t frame) const { return time[frame]; }
+        inline int64_t t(size_t frame) const {
+            if (!tInterval) return time[frame];
+            if (tSegments.empty()) return tStart + static_cast<int64_t>(frame) * tInterval;
+            return tSegmented(frame);
+        }
 
         inline int64_t tEnd() const { return t(num - 1); }
 
-        inline size_t tSize() const { return time.size(); }
+        inline size_t tSize() const { return tIsCompact() ? num : time.size(); }
+
+        inline bool tIsCompact() const { return tInterval != 0; }
+
+        /** sampling interval of a compact series, 0 if time is dense */
+        inline int64_t tStep() const { return tInterval; }
 
-        inline bool tIsCompact() const { return time.size() == 2; }
+        /**
+         * Switches to compact time (start + interval) if the series is regularly sampled, allowing the grid to restart
+         * up to num/16 times (gaps, off-grid samples). Saves the 8 bytes per row of the dense time vector.
+         * @return true if time is compact now
+         */
+        bool compactTime();
+
+        /**
+         * Switches back to the dense time vector.
+         */
+        void expandTime();
 
         void joinInner(const series &other);
 
+        /**
+         * Joins N time-sorted series in a single pass over all of them. The output (time plus the value columns of
+         * all inputs, in input order) is allocated once.
+         * @param tolerance for join_mode::asOf, max age of a row taken from another input
+         */
+        static series join(const std::vector<series_view> &inputs, join_mode mode, int64_t tolerance = 0);
+
         size_t fill(const std::function<bool(const float*row, size_t len)> &pred);
 
         size_t fill();
 
-    private:
-        size_t fillTimeGaps();
-    public:
+        /**
+         * Inserts the missing frames, assuming the sampling interval of the first two frames.
+         * Single pass, out of place: O(num + inserted). Returns the number of inserted frames.
+         */
+        size_t fillTimeGaps(fill_mode mode = fill_mode::previous, float value = 0.f);
+
+        /**
+         * Downsamples to buckets of `interval` (aligned to multiples of it, like GROUP BY time()) in a single pass.
+         * The time of a row is the start of its bucket, empty buckets are omitted (see fillTimeGaps()).
+         */
+        series resample(int64_t interval, aggregator agg) const;
+
+        /**
+         * Rolling-window aggregate of every column, one output row per row (see rolling_window in rolling.h).
+         */
+        series rolling(window_fn fn, window_size size) const;
+
+        /**
+         * Zero-copy view of the rows with t0 <= time < t1, O(log n).
+         */
+        series_view slice(int64_t t0, int64_t t1) const;
 
         size_t trim();
 
         template<class F>
         size_t trim(const F &pred) {
             size_t i = 0;
+            std::vector<float> row(columnar ? dataStride : 0);
             for (i = 0; i < num; ++i) {
-                if (pred(data.data() + i * dataStride, dataStride))
+                const float *r = data.data() + i * dataStride;
+                if (columnar) {
+                    for (size_t c = 0; c < dataStride; ++c) row[c] = at(i, c);
+                    r = row.data();
+                }
+                if (pred(r, dataStride))
                     break;
             }
 
             if (i > 0) {
+                sliceTime(i, num - i);
+                eraseRows(0, i);
                 num -= i;
-                time.erase(time.begin(), time.begin() + i);
-                data.erase(data.begin(), data.begin() + i * dataStride);
             }
 
             return i;
         }
 
-        static series sortedMerge(std::vector<series> &results);
+        /**
+         * Appends the rows of `other`, which must start after tEnd() and have the same columns. other is left empty.
+         * If this series is empty, other's buffers are moved instead of copied.
+         * NaNs are filled with the previous value (see fillForward()).
+         */
+        void append(series &&other);
+
+        /**
+         * Appends a copy of the rows of `other` (e.g. a memory-mapped cache file, see mapped_series), same
+         * requirements as append(series &&). Row-major rows are copied straight into this series' buffers.
+         */
+        void append(const series_view &other);
+
+        /**
+         * Rows the buffers hold without reallocating.
+         */
+        size_t capacity() const {
+            auto rows = dataStride ? data.capacity() / dataStride : data.capacity();
+            return tIsCompact() ? rows : std::min(rows, time.capacity());
+        }
+
+        /**
+         * Makes room for `rows` rows, so appending up to that many does not reallocate.
+         */
+        void reserve(size_t rows) {
+            if (!tIsCompact()) time.reserve(rows);
+            data.reserve(rows * dataStride);
+        }
+
+        /**
+         * Merges time-sorted results into one series, consuming them. Non-overlapping results are concatenated,
+         * overlapping ones interleaved with a k-way merge (O(n log k)) that keeps one row per timestamp.
+         */
+        static series sortedMerge(std::vector<series> &results, dedup_policy policy = dedup_policy::last);
 
         static void equalStartTimes(const std::vector<std::reference_wrapper<series>> &series, int64_t t);
 
 
         void checkNum() {
-            if (num != time.size()) {
+            if (num != tSize()) {
                 throw std::runtime_error("unexpected time len");
             }
 
@@ -105,6 +346,132 @@ namespace influxdb {
         }
     };
 
+    /**
+     * Non-owning view of the rows [offset, offset + num) of a series, valid as long as the series is not modified.
+     * Slicing is a binary search on time and copies nothing, so a window of a large fetched series can be analyzed
+     * in place. Read-only operations (resample, rolling, join) take views, a series converts implicitly.
+     * The rows may also live outside of a series, e.g. in a memory-mapped cache file (see mapped_series).
+     */
+    struct series_view {
+        const series *src{nullptr}; // name, tags, columns; time if it is compact
+        const int64_t *time{nullptr}; // dense time of all rows of the storage, nullptr if compact
+        const float *data{nullptr};
+        size_t rowsTotal{0}; // rows of the storage (column pitch if columnar)
+        size_t dataStride{0};
+        bool columnar{false};
+        size_t offset{0};
+        size_t num{0};
+
+        series_view() = default;
+
+        series_view(const series &s) // NOLINT(google-explicit-constructor)
+                : src(&s), time(s.tIsCompact() ? nullptr : s.time.data()), data(s.data.data()), rowsTotal(s.num),
+                  dataStride(s.dataStride), columnar(s.columnar), num(s.num) {}
+
+        series_view(const series &s, size_t offset, size_t num) : series_view(s) {
+            if (offset + num > s.num) throw std::out_of_range("series_view: rows out of range");
+            this->offset = offset;
+            this->num = num;
+        }
+
+        inline size_t stride() const { return dataStride; }
+
+        inline const std::vector<std::string> &columns() const { return src->columns; }
+
+        inline bool empty() const { return num == 0; }
+
+        inline bool isColumnar() const { return columnar; }
+
+        inline int64_t t(size_t i) const { return time ? time[offset + i] : src->t(offset + i); }
+
+        inline float at(size_t row, size_t col) const {
+            return columnar ? data[col * rowsTotal + offset + row] : data[(offset + row) * dataStride + col];
+        }
+
+        /**
+         * Values of a row, row-major series only.
+         */
+        inline const float *row(size_t r) const { return data + (offset + r) * dataStride; }
+
+        inline column_view<const float> column(size_t col) const {
+            return columnar ? column_view<const float>{data + col * rowsTotal + offset, 1, num}
+                            : column_view<const float>{data + offset * dataStride + col, dataStride, num};
+        }
+
+        /**
+         * First row with time >= t, num if there is none.
+         */
+        size_t lowerBound(int64_t t) const;
+
+        /**
+         * Rows with t0 <= time < t1.
+         */
+        series_view slice(int64_t t0, int64_t t1) const;
+
+        inline series_view rows(size_t start, size_t count) const {
+            if (start + count > num) throw std::out_of_range("series_view: rows out of range");
+            series_view v(*this);
+            v.offset += start;
+            v.num = count;
+            return v;
+        }
+
+        /**
+         * Copies the rows into a new series (same layout, compact time is kept).
+         */
+        series toSeries() const;
+
+        series resample(int64_t interval, aggregator agg) const;
+
+        series rolling(window_fn fn, window_size size) const;
+    };
+
+    /**
+     * Binary series format of operator<< / operator>> (cache files): this header, the metadata (name, tags and
+     * columns as length-prefixed strings), then the time array (omitted if time is compact) and the data array in
+     * the layout of the series, both 64-byte aligned relative to the header. Native byte order. The checksum covers
+     * metadata, time and data, so a file can be memory-mapped and used in place (see mapped_series).
+     */
+    struct series_file_header {
+        static const char *magicString() { return "IFXSER\0"; } // 8 bytes with the terminator
+        static constexpr uint32_t Version = 1;
+        static constexpr uint32_t CompactTime = 1, Columnar = 2; // flags
+        // time and data are one gorilla stream (see gorilla.h) at timeOffset(), preceded by its uint64 length.
+        // CompactTime then only records that time was compact, it is compacted again after decoding
+        static constexpr uint32_t Gorilla = 4;
+        static constexpr size_t Align = 64;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint64_t num;
+        uint64_t dataStride;
+        int64_t tStart;
+        int64_t tInterval;
+        uint64_t metaLen;
+        uint64_t checksum;
+
+        static size_t aligned(size_t n) { return (n + Align - 1) / Align * Align; }
+
+        size_t timeOffset() const { return aligned(sizeof(series_file_header) + metaLen); }
+
+        size_t dataOffset() const {
+            return aligned(timeOffset() + ((flags & CompactTime) ? 0 : num * sizeof(int64_t)));
+        }
+
+        /** size of an uncompressed file */
+        size_t size() const { return dataOffset() + num * dataStride * sizeof(float); }
+
+        /** upper bound of the gorilla stream length */
+        size_t maxEncodedSize() const { return (64 + num * 68 + dataStride * (32 + num * 44)) / 8 + 32; }
+    };
+
+    static_assert(sizeof(series_file_header) == series_file_header::Align, "series_file_header layout");
+
+    /**
+     * 64-bit checksum of the binary series format, continues `h`.
+     */
+    uint64_t seriesChecksum(uint64_t h, const void *p, size_t len);
 
     typedef series fetchResult;
 
@@ -119,36 +486,20 @@ namespace influxdb {
         s.read(reinterpret_cast<char *>(&v), sizeof(T));
     }
 
+    /**
+     * Writes the binary series format, with `compress` time and data are gorilla encoded.
+     */
+    void writeSeries(std::ostream &s, const series &fr, bool compress = false);
+
+    void readSeries(std::istream &s, series &fr);
+
     static std::ostream &operator<<(std::ostream &s, const fetchResult &fr) {
-        auto cn = fr.columns.size();
-        _write(s, cn), _write(s, fr.num), _write(s, fr.dataStride);
-        _write(s, '\n');
-        for (auto &col:fr.columns) s << col << " ";
-        _write(s, '\n');
-        for (size_t i = 0; i < fr.num; ++i) {
-            _write(s, fr.t(i));
-            for (size_t ci = 0; ci < fr.dataStride; ++ci) _write(s, fr.data[i * fr.dataStride + ci]);
-        }
+        writeSeries(s, fr);
         return s;
     }
 
     static std::istream &operator>>(std::istream &s, fetchResult &fr) {
-        size_t cn;
-        _readVal<size_t>(s, cn), _readVal(s, fr.num), _readVal<size_t>(s, fr.dataStride);
-        fr.columns.resize(cn);
-        fr.time.resize(fr.num);
-        fr.data.resize(fr.num * fr.dataStride);
-        // LOG_E << LOG_EXPR(cn)<< LOG_EXPR(fr.num) << LOG_EXPR(fr.dataStride);
-        if (s.get() != '\n') throw std::runtime_error("invalid fetchResult header (1)");
-        for (int i = 0; i < cn; ++i) s >> fr.columns[i];
-        // LOG_E << fr.columns[0];
-        if (s.get() != '\n' && s.get() != '\n') throw std::runtime_error("invalid fetchResult header (2) ");
-
-        for (size_t i = 0; i < fr.num; ++i) {
-            _readVal(s, fr.time[i]);
-            for (size_t ci = 0; ci < fr.dataStride; ++ci) _readVal(s, fr.data[i * fr.dataStride + ci]);
-        }
-        if (s.fail()) throw std::runtime_error("stream fail after fetchResult read");
+        readSeries(s, fr);
         return s;
     }
 }
\ No newline at end of file
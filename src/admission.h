@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace influxdb {
+
+    /**
+     * Bounded FIFO of not-yet-dispatched requests. A request is dispatched as soon as a slot is available,
+     * both in the per-queue limit (maxPending) and the process-wide limit shared by all queues (see setGlobalLimit).
+     * Slots are given back with release(), which dispatches the next queued request(s) on the calling thread.
+     * submit() never blocks. Requests still queued when the queue is destroyed are rejected.
+     */
+    class admission_queue {
+    public:
+        typedef std::function<void()> task;
+        typedef std::function<void(std::exception_ptr)> reject_fn;
+
+    private:
+        const size_t maxPending;
+        const size_t maxQueued;
+
+        struct entry {
+            task run;
+            reject_fn reject;
+        };
+
+        std::mutex mtx;
+        std::deque<entry> queue;
+        size_t pending{0};
+
+        struct global_state {
+            std::atomic<size_t> pending{0};
+            std::atomic<size_t> limit{0}; // 0 = unlimited
+            std::mutex mtx;
+            std::set<admission_queue *> queues;
+            size_t draining{0}; // release() calls iterating over a copy of queues
+            std::condition_variable idle;
+        };
+
+        static global_state &global() {
+            static global_state g;
+            return g;
+        }
+
+        static bool tryAcquireGlobal() {
+            auto &g(global());
+            auto lim = g.limit.load();
+            auto cur = g.pending.load();
+            do {
+                if (lim != 0 && cur >= lim) return false;
+            } while (!g.pending.compare_exchange_weak(cur, cur + 1));
+            return true;
+        }
+
+        void drain() {
+            for (;;) {
+                task next;
+                {
+                    std::lock_guard<std::mutex> lk{mtx};
+                    if (queue.empty() || pending >= maxPending || !tryAcquireGlobal())
+                        return;
+                    next = std::move(queue.front().run);
+                    queue.pop_front();
+                    ++pending;
+                }
+                next();
+            }
+        }
+
+    public:
+        admission_queue(size_t maxPending, size_t maxQueued) : maxPending{maxPending ? maxPending : 1},
+                                                               maxQueued{maxQueued} {
+            auto &g(global());
+            std::lock_guard<std::mutex> lk{g.mtx};
+            g.queues.insert(this);
+        }
+
+        ~admission_queue() {
+            auto &g(global());
+            std::unique_lock<std::mutex> lk{g.mtx};
+            g.queues.erase(this);
+            // a release() of another queue may still be about to drain this one
+            g.idle.wait(lk, [&g]() { return g.draining == 0; });
+            lk.unlock();
+
+            // requests in flight never finish (their event loop is gone), give back their global slots. Queued ones
+            // are rejected, so their owners are not left waiting
+            g.pending -= pending;
+            auto e = std::make_exception_ptr(std::runtime_error("admission queue destroyed, request not sent"));
+            for (auto &q : queue) {
+                if (q.reject) q.reject(e);
+            }
+        }
+
+        admission_queue(const admission_queue &) = delete;
+
+        admission_queue &operator=(const admission_queue &) = delete;
+
+        /**
+         * Limit the number of in-flight requests across all queues of the process. 0 disables the limit.
+         */
+        static void setGlobalLimit(size_t limit) {
+            global().limit = limit;
+        }
+
+        /**
+         * Enqueue a request. The task is either run immediately on the calling thread or later by release(). If
+         * the queue is destroyed first, `reject` is called instead (on the destroying thread).
+         * Throws if the queue is full.
+         */
+        void submit(task &&t, reject_fn &&reject = nullptr) {
+            {
+                std::lock_guard<std::mutex> lk{mtx};
+                if (queue.size() >= maxQueued)
+                    throw std::runtime_error("admission queue full (" + std::to_string(maxQueued) + " requests)");
+                queue.push_back({std::move(t), std::move(reject)});
+            }
+            drain();
+        }
+
+        /**
+         * Give back the slot of a finished request and dispatch queued requests.
+         */
+        void release() {
+            {
+                std::lock_guard<std::mutex> lk{mtx};
+                --pending;
+            }
+            --global().pending;
+            drain();
+
+            auto &g(global());
+            if (g.limit == 0) return;
+            // a global slot became free, give other clients a chance. Drained without the lock, a dispatched task
+            // may release() or submit() again
+            std::vector<admission_queue *> others;
+            {
+                std::lock_guard<std::mutex> lk{g.mtx};
+                others.reserve(g.queues.size());
+                for (auto q : g.queues) {
+                    if (q != this) others.push_back(q);
+                }
+                ++g.draining;
+            }
+            auto done = [&g]() {
+                std::lock_guard<std::mutex> lk{g.mtx};
+                if (--g.draining == 0) g.idle.notify_all();
+            };
+            try {
+                for (auto q : others) q->drain();
+            } catch (...) {
+                done();
+                throw;
+            }
+            done();
+        }
+
+        size_t numPending() {
+            std::lock_guard<std::mutex> lk{mtx};
+            return pending;
+        }
+
+        size_t numQueued() {
+            std::lock_guard<std::mutex> lk{mtx};
+            return queue.size();
+        }
+    };
+}
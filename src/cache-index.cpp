@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../cpp-base64/base64.h"
+#include "cache-index.h"
+#include "mapped-series.h"
+
+namespace influxdb {
+
+    static_assert(sizeof(cache_index::key_type) == 16, "cache_index::key_type layout");
+
+    static int64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t randomId() {
+        // per thread, nothing to lock and no function static that may be destroyed before a maintenance thread ends
+        thread_local std::mt19937_64 rng{std::random_device{}() ^ static_cast<uint64_t>(nowMs())
+                                         ^ std::hash<std::thread::id>{}(std::this_thread::get_id())};
+        uint64_t v;
+        do v = rng(); while (v == 0);
+        return v;
+    }
+
+    static uint64_t fileSize(const std::string &path) {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        return f.good() ? static_cast<uint64_t>(f.tellg()) : 0;
+    }
+
+    struct index_registry {
+        std::mutex mtx;
+        std::unordered_map<std::string, std::shared_ptr<cache_index>> indexes;
+    };
+
+    static index_registry &registry() {
+        static index_registry r;
+        return r;
+    }
+
+    std::shared_ptr<cache_index> cache_index::open(const std::string &dir) {
+        auto &r(registry());
+        std::lock_guard<std::mutex> lock(r.mtx);
+        auto &idx = r.indexes[dir];
+        if (!idx) idx = std::make_shared<cache_index>(dir);
+        return idx;
+    }
+
+    void cache_index::stopMaintenance(const std::string &dir) {
+        std::shared_ptr<cache_index> idx;
+        {
+            auto &r(registry());
+            std::lock_guard<std::mutex> lock(r.mtx);
+            auto it = r.indexes.find(dir);
+            if (it != r.indexes.end()) idx = it->second;
+        }
+        if (idx) idx->stop();
+    }
+
+    int cache_index::mkdir(const std::string &dir) {
+#ifdef WIN32
+        return ::mkdir(dir.c_str());
+#else
+        return ::mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+#endif
+    }
+
+    cache_index::cache_index(std::string dir) : dir(dir), manifest(dir + "/MANIFEST") {
+        std::unique_ptr<mapped_file> m;
+        try {
+            m = std::make_unique<mapped_file>(manifest);
+        } catch (const std::exception &) {
+            // no manifest yet
+        }
+        if (m && m->size() >= HeaderLen && std::memcmp(m->data(), Magic, sizeof(Magic)) == 0) {
+            std::memcpy(&id, m->data() + sizeof(Magic), sizeof(id));
+            loadedLen = HeaderLen;
+            replay(m->data() + HeaderLen, m->size() - HeaderLen);
+        }
+        m.reset();
+        if (loadedLen == 0 || numRecords > 2 * entries.size() + 1024) rewrite();
+        reopen();
+        lastRefresh = std::chrono::steady_clock::now();
+    }
+
+    cache_index::~cache_index() {
+        stop();
+        if (log) std::fclose(log);
+    }
+
+    void cache_index::apply(const record &r) {
+        key_type key{r.key0, r.key1};
+        auto it = entries.find(key);
+        entry prev{};
+        bool had = it != entries.end();
+        if (had) {
+            prev = it->second;
+            totalBytes -= prev.size;
+            if (prev.segment) { // the segment file keeps its size until it is deleted
+                auto &live(segmentBytes[prev.segment]);
+                live -= std::min(live, prev.size);
+                if (live == 0) {
+                    segmentBytes.erase(prev.segment);
+                    deadSegments.push_back(prev.segment);
+                }
+            } else {
+                fileBytes -= prev.size;
+            }
+            entries.erase(it);
+        }
+        if (r.size != Removed) {
+            // moving an entry (compaction) keeps its access statistics
+            bool moved = had && prev.mtime == r.mtime && prev.size == r.size;
+            entries.emplace(key, entry{r.size, r.mtime, r.group, r.segment, r.offset, moved ? prev.atime : r.mtime,
+                                       moved ? prev.hits : 0});
+            totalBytes += r.size;
+            if (r.segment) {
+                segmentBytes[r.segment] += r.size;
+                auto &extent(segmentExtent[r.segment]);
+                if (r.offset + r.size > extent) fileBytes += r.offset + r.size - extent, extent = r.offset + r.size;
+            } else {
+                fileBytes += r.size;
+            }
+        }
+        ++numRecords;
+    }
+
+    void cache_index::replay(const char *p, size_t len) {
+        // a torn record at the end is read again with the next refresh
+        size_t n = len / sizeof(record);
+        for (size_t i = 0; i < n; ++i) {
+            record r{};
+            std::memcpy(&r, p + i * sizeof(record), sizeof(record));
+            apply(r);
+        }
+        loadedLen += n * sizeof(record);
+    }
+
+    void cache_index::append(const record &r) {
+        // our handle would append to a manifest another process has replaced since, reload it first
+        if (manifestId() != id) refreshLocked();
+        // one unbuffered write per record, appends of other processes do not interleave with it
+        if (std::fwrite(&r, sizeof(r), 1, log) != 1 || std::fflush(log) != 0)
+            throw std::runtime_error("cant append to " + manifest);
+        // the caller applies r, so skip it with the next replay unless records of others came before it
+        auto end = std::ftell(log);
+        if (end >= 0 && static_cast<size_t>(end) == loadedLen + sizeof(r)) loadedLen = static_cast<size_t>(end);
+    }
+
+    void cache_index::rewrite() {
+        id = randomId();
+        std::vector<record> records;
+        records.reserve(entries.size());
+        for (auto &kv : entries) {
+            auto &e(kv.second);
+            records.push_back({kv.first.first, kv.first.second, e.size, e.mtime, e.group, e.segment, e.offset});
+        }
+
+        auto tmp = manifest + ".tmp" + std::to_string(id);
+        {
+            std::ofstream f(tmp, std::ios::binary);
+            f.write(Magic, sizeof(Magic));
+            f.write(reinterpret_cast<const char *>(&id), sizeof(id));
+            f.write(reinterpret_cast<const char *>(records.data()),
+                    static_cast<std::streamsize>(records.size() * sizeof(record)));
+            f.close();
+            if (!f.good()) {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("cant write " + tmp);
+            }
+        }
+#ifdef _WIN32
+        std::remove(manifest.c_str()); // rename does not replace on windows, elsewhere it replaces atomically
+#endif
+        if (std::rename(tmp.c_str(), manifest.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("cant rename " + tmp);
+        }
+        numRecords = records.size();
+        loadedLen = HeaderLen + records.size() * sizeof(record);
+    }
+
+    void cache_index::reopen() {
+        if (log) std::fclose(log);
+        log = std::fopen(manifest.c_str(), "ab");
+        if (!log) throw std::runtime_error("cant open " + manifest);
+        std::setvbuf(log, nullptr, _IONBF, 0);
+    }
+
+    uint64_t cache_index::readId(std::istream &f) {
+        char header[HeaderLen];
+        if (!f.read(header, HeaderLen) || std::memcmp(header, Magic, sizeof(Magic)) != 0) return 0;
+        uint64_t fileId;
+        std::memcpy(&fileId, header + sizeof(Magic), sizeof(fileId));
+        return fileId;
+    }
+
+    uint64_t cache_index::manifestId() const {
+        std::ifstream f(manifest, std::ios::binary);
+        return readId(f);
+    }
+
+    void cache_index::refreshLocked() {
+        lastRefresh = std::chrono::steady_clock::now();
+        std::ifstream f(manifest, std::ios::binary);
+        auto fileId = readId(f);
+        if (fileId == 0) return;
+        if (fileId != id) {
+            // rewritten by another process, our log handle appends to the replaced file
+            entries.clear();
+            segmentBytes.clear();
+            segmentExtent.clear();
+            totalBytes = 0;
+            fileBytes = 0;
+            numRecords = 0;
+            id = fileId;
+            loadedLen = HeaderLen;
+            reopen();
+        }
+        f.seekg(static_cast<std::streamoff>(loadedLen));
+        std::string tail((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        replay(tail.data(), tail.size());
+    }
+
+    void cache_index::refresh() {
+        std::lock_guard<std::mutex> lock(mtx);
+        refreshLocked();
+    }
+
+    bool cache_index::find(const key_type &key, entry &e) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it == entries.end() && std::chrono::steady_clock::now() - lastRefresh >= RefreshInterval) {
+            refreshLocked();
+            it = entries.find(key);
+        }
+        if (it == entries.end()) return false;
+        it->second.atime = nowMs();
+        ++it->second.hits;
+        e = it->second;
+        return true;
+    }
+
+    std::pair<std::string, std::string> cache_index::dirAndFile(const key_type &key) const {
+        auto b1 = base64_encode(reinterpret_cast<const unsigned char *>(&key.first), 8);
+        auto b2 = base64_encode(reinterpret_cast<const unsigned char *>(&key.second), 8);
+        auto b = b1.substr(0, b1.length() - 1) + b2.substr(0, b2.length() - 1);
+        std::replace(b.begin(), b.end(), '+', '-');
+        std::replace(b.begin(), b.end(), '/', '_');
+        auto d = dir + '/' + b.substr(0, 2);
+        return {d, d + '/' + b.substr(2)};
+    }
+
+    std::string cache_index::segmentFile(uint64_t segment) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.seg", static_cast<unsigned long long>(segment));
+        return dir + "/segments/" + name;
+    }
+
+    std::string cache_index::path(const key_type &key, const entry &e) const {
+        return e.segment ? segmentFile(e.segment) : dirAndFile(key).second;
+    }
+
+    void cache_index::add(const key_type &key, uint64_t size, uint64_t group) {
+        record r{key.first, key.second, size, nowMs(), group, 0, 0};
+        std::lock_guard<std::mutex> lock(mtx);
+        append(r);
+        apply(r);
+        grown = true;
+        if (overBudget()) wake.notify_all();
+    }
+
+    void cache_index::remove(const key_type &key) {
+        record r{key.first, key.second, Removed, nowMs(), 0, 0, 0};
+        std::lock_guard<std::mutex> lock(mtx);
+        if (entries.find(key) == entries.end()) return;
+        append(r);
+        apply(r);
+    }
+
+    bool cache_index::remove(const key_type &key, const entry &e) {
+        record r{key.first, key.second, Removed, nowMs(), 0, 0, 0};
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it == entries.end() || it->second.mtime != e.mtime || it->second.segment != e.segment
+            || it->second.offset != e.offset)
+            return false;
+        append(r);
+        apply(r);
+        return true;
+    }
+
+    size_t cache_index::size() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return entries.size();
+    }
+
+    uint64_t cache_index::bytes() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return totalBytes;
+    }
+
+    uint64_t cache_index::diskBytes() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return diskBytesLocked();
+    }
+
+    void cache_index::pending(int64_t bytes) {
+        std::lock_guard<std::mutex> lock(mtx);
+        tempBytes += bytes;
+    }
+
+    bool cache_index::firstUse(const std::string &subdir) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return subdirs.insert(subdir).second;
+    }
+
+    void cache_index::setLimits(const cache_limits &l) {
+        std::lock_guard<std::mutex> lock(mtx);
+        limits = l;
+        grown = true; // a lower budget is applied right away
+        if (!worker.joinable()) worker = std::thread(&cache_index::run, this, workerGen);
+        wake.notify_all();
+    }
+
+    void cache_index::stop() {
+        std::thread w;
+        {
+            // a worker started by setLimits() meanwhile has the new generation and keeps running
+            std::lock_guard<std::mutex> lock(mtx);
+            ++workerGen;
+            w.swap(worker);
+        }
+        wake.notify_all();
+        if (w.joinable()) w.join();
+    }
+
+    void cache_index::run(unsigned gen) {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (gen == workerGen) {
+            // a budget the last pass could not meet (entries in use, a large manifest) waits for the next add()
+            // or the interval instead of spinning
+            wake.wait_for(lock, MaintenanceInterval, [this, gen]() {
+                return gen != workerGen || (grown && overBudget());
+            });
+            if (gen != workerGen) break;
+            grown = false;
+            lock.unlock();
+            try {
+                maintain();
+            } catch (const std::exception &e) {
+                LOG_W << "cache maintenance failed: " << e.what();
+            }
+            lock.lock();
+        }
+    }
+
+    void cache_index::maintain() {
+        bool compaction;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            compaction = limits.compact;
+            // the manifest counts toward the budget, keep it from growing with superseded records
+            if (numRecords > 2 * entries.size() + 1024) {
+                refreshLocked(); // the records other processes appended since go into the new manifest too
+                rewrite();
+                reopen();
+            }
+        }
+        evict();
+        if (compaction) compact();
+        deleteDeadSegments();
+    }
+
+    void cache_index::evict() {
+        // unit of eviction is a file: an own file or a whole segment (with its dead bytes)
+        struct unit {
+            uint64_t bytes = 0;
+            int64_t atime = 0;
+            uint64_t hits = 0;
+            std::vector<item> items;
+        };
+        std::vector<item> snapshot;
+        std::unordered_map<uint64_t, uint64_t> extents;
+        uint64_t excess;
+        cache_eviction policy;
+        {
+            // only a flat copy under the lock, find() waits for it
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!overBudget()) return;
+            excess = diskBytesLocked() - limits.maxBytes / 10 * 9; // down to 90%, not evicting on every add
+            policy = limits.eviction;
+            snapshot.reserve(entries.size());
+            for (auto &kv : entries) snapshot.push_back({kv.first, kv.second});
+            extents = segmentExtent;
+        }
+
+        std::unordered_map<uint64_t, unit> segments;
+        std::vector<unit> units;
+        for (auto &it : snapshot) {
+            unit single, &u(it.e.segment ? segments[it.e.segment] : single);
+            u.bytes += it.e.size;
+            u.atime = std::max(u.atime, it.e.atime);
+            u.hits += it.e.hits;
+            u.items.push_back(it);
+            if (!it.e.segment) units.push_back(std::move(single));
+        }
+        for (auto &kv : segments) {
+            auto ext = extents.find(kv.first);
+            if (ext != extents.end()) kv.second.bytes = std::max(kv.second.bytes, ext->second);
+            units.push_back(std::move(kv.second));
+        }
+        std::sort(units.begin(), units.end(), [policy](const unit &a, const unit &b) {
+            if (policy == cache_eviction::lfu && a.hits != b.hits) return a.hits < b.hits;
+            return a.atime < b.atime;
+        });
+
+        uint64_t freed = 0;
+        for (auto &u : units) {
+            if (freed >= excess) break;
+            bool all = true;
+            for (auto &it : u.items) {
+                // an entry rewritten meanwhile stays
+                if (!remove(it.key, it.e)) {
+                    all = false;
+                    continue;
+                }
+                if (!it.e.segment) std::remove(dirAndFile(it.key).second.c_str());
+            }
+            if (all) freed += u.bytes; // a segment file is deleted by deleteDeadSegments()
+        }
+        LOG_D << "cache evicted " << freed << " bytes from " << dir;
+    }
+
+    void cache_index::compact() {
+        std::unordered_map<uint64_t, std::vector<item>> groups;
+        std::vector<std::pair<uint64_t, uint64_t>> segments; // id, live bytes
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto &kv : entries) {
+                auto &e(kv.second);
+                if (!e.segment && e.group && e.size < SmallEntry) groups[e.group].push_back({kv.first, e});
+            }
+            segments.assign(segmentBytes.begin(), segmentBytes.end());
+        }
+
+        for (auto &kv : groups) {
+            auto &items(kv.second);
+            if (items.size() < MinPack) continue;
+            std::sort(items.begin(), items.end(), [](const item &a, const item &b) { return a.e.mtime < b.e.mtime; });
+            pack(items);
+        }
+
+        // segments that lost more than half of their bytes (replaced or evicted entries) are packed again
+        for (auto &seg : segments) {
+            if (fileSize(segmentFile(seg.first)) <= 2 * seg.second) continue;
+            std::vector<item> items;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                for (auto &kv : entries) if (kv.second.segment == seg.first) items.push_back({kv.first, kv.second});
+            }
+            std::sort(items.begin(), items.end(), [](const item &a, const item &b) { return a.e.offset < b.e.offset; });
+            pack(items);
+        }
+    }
+
+    void cache_index::pack(const std::vector<item> &items) {
+        static const char zeros[SegmentAlign] = {};
+        if (firstUse(dir + "/segments")) mkdir(dir + "/segments");
+
+        for (size_t begin = 0; begin < items.size();) {
+            auto segment = randomId();
+            auto file = segmentFile(segment), tmp = file + ".tmp";
+            std::vector<uint64_t> offsets;
+            uint64_t tmpLen = 0;
+            size_t end = begin;
+            {
+                std::ofstream out(tmp, std::ios::binary);
+                if (!out.good()) throw std::runtime_error("cant open " + tmp + " for writing");
+                uint64_t pos = 0;
+                std::string buf;
+                for (; end < items.size() && pos < SegmentSize; ++end) {
+                    auto &it(items[end]);
+                    std::ifstream in(path(it.key, it.e), std::ios::binary);
+                    if (it.e.segment) in.seekg(static_cast<std::streamoff>(it.e.offset));
+                    buf.resize(it.e.size);
+                    if (!in.read(&buf[0], static_cast<std::streamsize>(buf.size()))) {
+                        offsets.push_back(Removed); // gone meanwhile
+                        continue;
+                    }
+                    auto pad = (SegmentAlign - pos % SegmentAlign) % SegmentAlign;
+                    out.write(zeros, static_cast<std::streamsize>(pad));
+                    out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+                    offsets.push_back(pos + pad);
+                    pos += pad + buf.size();
+                }
+                out.close();
+                if (!out.good()) {
+                    std::remove(tmp.c_str());
+                    throw std::runtime_error("write failure with " + tmp);
+                }
+                tmpLen = pos;
+            }
+            pending(static_cast<int64_t>(tmpLen)); // until its entries are moved, then it is a segment
+            if (std::rename(tmp.c_str(), file.c_str()) != 0) {
+                std::remove(tmp.c_str());
+                pending(-static_cast<int64_t>(tmpLen));
+                throw std::runtime_error("cant rename " + tmp);
+            }
+
+            // move the entries that did not change meanwhile
+            std::vector<std::string> obsolete;
+            bool used = false;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                tempBytes -= static_cast<int64_t>(tmpLen);
+                for (size_t i = begin; i < end; ++i) {
+                    auto &it(items[i]);
+                    auto cur = entries.find(it.key);
+                    if (offsets[i - begin] == Removed || cur == entries.end() || cur->second.mtime != it.e.mtime
+                        || cur->second.segment != it.e.segment || cur->second.offset != it.e.offset)
+                        continue;
+                    record r{it.key.first, it.key.second, it.e.size, it.e.mtime, it.e.group, segment,
+                             offsets[i - begin]};
+                    append(r);
+                    apply(r);
+                    used = true;
+                    if (!it.e.segment) obsolete.push_back(dirAndFile(it.key).second);
+                }
+            }
+            if (!used) std::remove(file.c_str());
+            for (auto &f : obsolete) std::remove(f.c_str());
+            begin = end;
+        }
+    }
+
+    void cache_index::deleteDeadSegments() {
+        std::vector<uint64_t> dead;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            dead.swap(deadSegments);
+        }
+        for (auto seg : dead) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (segmentBytes.count(seg)) continue;
+                auto ext = segmentExtent.find(seg);
+                if (ext != segmentExtent.end()) {
+                    fileBytes -= ext->second;
+                    segmentExtent.erase(ext);
+                }
+            }
+            std::remove(segmentFile(seg).c_str());
+        }
+    }
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "client.h"
+
+namespace influxdb {
+
+    /**
+     * In-memory index of the entries of a file_cache directory, so lookups are hash table hits instead of filesystem
+     * probes. It is persisted in `dir/MANIFEST`, an append-only log of fixed-size add/remove records that is mapped
+     * and replayed on open, and rewritten on open once it is mostly superseded records. Processes sharing a directory
+     * append to the same manifest, a miss replays their new records (at most once per RefreshInterval). A manifest
+     * rewritten by another process is detected by its id and reloaded.
+     *
+     * An entry is either a file of its own (dir/xx/fingerprint) or a range of a segment file (dir/segments/id.seg).
+     * With setLimits(), a background thread keeps the directory (see diskBytes()) within a byte budget and packs the
+     * small entries of a query (same group) into segments, holding the index lock only to snapshot and to commit. Readers racing with it
+     * see an entry either at its old or its new location, file_cache retries once after a refresh().
+     *
+     * Entries written before the manifest existed are not indexed, they are refetched and overwritten.
+     */
+    class cache_index {
+    public:
+        typedef std::pair<uint64_t, uint64_t> key_type; // Fingerprint128 of the cache key
+
+        struct entry {
+            uint64_t size; // bytes
+            int64_t mtime; // ms since epoch
+            uint64_t group; // entries of one query, packed together
+            uint64_t segment; // 0 for an own file
+            uint64_t offset; // in the segment
+            int64_t atime; // last find(), not persisted (mtime after a restart)
+            uint32_t hits; // find()s since open
+        };
+
+        static constexpr std::chrono::milliseconds RefreshInterval{1000};
+        static constexpr std::chrono::seconds MaintenanceInterval{60};
+        static constexpr uint64_t SmallEntry = 1u << 20u; // packed into segments
+        static constexpr size_t MinPack = 8; // entries of a group worth a segment
+        static constexpr uint64_t SegmentSize = 64u << 20u;
+        static constexpr uint64_t SegmentAlign = 64; // series_file_header::Align, keeps mapped data aligned
+
+        /**
+         * Shared index of `dir`, loaded on first use. Throws if the manifest cannot be created.
+         */
+        static std::shared_ptr<cache_index> open(const std::string &dir);
+
+        static int mkdir(const std::string &dir);
+
+        /**
+         * Stops the background thread of `dir` if its index is open, see stop().
+         */
+        static void stopMaintenance(const std::string &dir);
+
+        explicit cache_index(std::string dir);
+
+        cache_index(const cache_index &) = delete;
+
+        cache_index &operator=(const cache_index &) = delete;
+
+        ~cache_index();
+
+        /**
+         * Looks up an entry and counts the access.
+         */
+        bool find(const key_type &key, entry &e);
+
+        /**
+         * File holding the entry (at e.offset).
+         */
+        std::string path(const key_type &key, const entry &e) const;
+
+        /**
+         * Own file of an entry, set() writes it there.
+         */
+        std::pair<std::string, std::string> dirAndFile(const key_type &key) const;
+
+        /**
+         * Records an own file of `size` bytes.
+         */
+        void add(const key_type &key, uint64_t size, uint64_t group = 0);
+
+        void remove(const key_type &key);
+
+        /**
+         * Removes the entry if it is still `e`, returns false if it changed since.
+         */
+        bool remove(const key_type &key, const entry &e);
+
+        size_t size() const;
+
+        /** total size of the indexed entries */
+        uint64_t bytes() const;
+
+        /**
+         * Size of the directory as limited by setLimits(): own files, segment files including their dead bytes, the
+         * manifest and temp files being written.
+         */
+        uint64_t diskBytes() const;
+
+        /**
+         * Counts a temp file of `bytes` toward diskBytes(), negative once it is renamed or removed.
+         */
+        void pending(int64_t bytes);
+
+        /**
+         * True the first time `subdir` is passed, the caller creates it then.
+         */
+        bool firstUse(const std::string &subdir);
+
+        /**
+         * Applies the records other processes appended since the last load.
+         */
+        void refresh();
+
+        /**
+         * Sets the budget and compaction and starts the background thread.
+         */
+        void setLimits(const cache_limits &l);
+
+        /**
+         * Stops and joins the background thread, setLimits() starts it again.
+         */
+        void stop();
+
+        /**
+         * One eviction and compaction pass, as run by the background thread.
+         */
+        void maintain();
+
+    private:
+        struct record {
+            uint64_t key0, key1;
+            uint64_t size; // Removed for a remove record
+            int64_t mtime;
+            uint64_t group;
+            uint64_t segment;
+            uint64_t offset;
+        };
+
+        struct key_hash {
+            size_t operator()(const key_type &k) const { return static_cast<size_t>(k.first); } // a fingerprint
+        };
+
+        struct item {
+            key_type key;
+            entry e;
+        };
+
+        static constexpr uint64_t Removed = ~uint64_t(0);
+        static constexpr char Magic[8] = {'I', 'F', 'X', 'I', 'D', 'X', '2', '\0'};
+        static constexpr size_t HeaderLen = 16; // magic, id
+
+        const std::string dir, manifest;
+        mutable std::mutex mtx;
+        uint64_t id = 0; // of the manifest file
+        std::unordered_map<key_type, entry, key_hash> entries;
+        std::unordered_map<uint64_t, uint64_t> segmentBytes; // live bytes per segment
+        std::unordered_map<uint64_t, uint64_t> segmentExtent; // file size per segment, until it is deleted
+        std::vector<uint64_t> deadSegments; // without live entries, to delete
+        uint64_t totalBytes = 0;
+        uint64_t fileBytes = 0; // own files and segment files
+        int64_t tempBytes = 0;
+        size_t numRecords = 0;
+        size_t loadedLen = 0; // manifest bytes replayed
+        std::chrono::steady_clock::time_point lastRefresh{};
+        std::unordered_set<std::string> subdirs;
+        std::FILE *log = nullptr;
+
+        cache_limits limits{};
+        std::thread worker;
+        std::condition_variable wake;
+        bool grown = true; // add() or setLimits() since the last maintenance pass
+        unsigned workerGen = 0; // stop() increments it, the worker of an older generation ends
+
+        void apply(const record &r);
+
+        void replay(const char *p, size_t len);
+
+        void append(const record &r);
+
+        void rewrite();
+
+        void reopen();
+
+        void refreshLocked();
+
+        /** id in the manifest header, 0 if it is missing or invalid */
+        static uint64_t readId(std::istream &f);
+
+        uint64_t manifestId() const;
+
+        uint64_t diskBytesLocked() const {
+            return fileBytes + loadedLen + static_cast<uint64_t>(tempBytes > 0 ? tempBytes : 0);
+        }
+
+        bool overBudget() const { return limits.maxBytes && diskBytesLocked() > limits.maxBytes; }
+
+        std::string segmentFile(uint64_t segment) const;
+
+        void run(unsigned gen);
+
+        void evict();
+
+        void compact();
+
+        void pack(const std::vector<item> &items);
+
+        void deleteDeadSegments();
+    };
+}
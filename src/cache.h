@@ -1,100 +1,217 @@
+#pragma once
+
 #ifdef MINGW
 # define __LITTLE_ENDIAN__
 #endif
 
 #include "../farmhash/src/farmhash.h"
-#include "../cpp-base64/base64.h"
+#include <chrono>
+#include <cstdio>
+#include <future>
 #include <string>
+#include <thread>
 #include <fstream>
-#include <sys/types.h>
-#include <sys/stat.h>
+
+#include "cache-index.h"
+#include "client.h"
+#include "mapped-series.h"
+#include "tag-dict.h"
 
 
 namespace influxdb {
 
 
+    /**
+     * The series of one fetchGroups() batch as stored in the file cache. The tags are stored as strings and
+     * interned into `dict` on read.
+     */
+    struct grouped_batch {
+        std::vector<series> &series_;
+        tag_dict &dict;
+    };
+
+    static void _writeString(std::ostream &s, const std::string &str) {
+        _write(s, str.size());
+        s.write(str.data(), static_cast<std::streamsize>(str.size()));
+    }
+
+    static std::string _readString(std::istream &s) {
+        size_t len = 0;
+        _readVal(s, len);
+        if (!s.good() || len > (1u << 20u)) throw std::runtime_error("invalid grouped_batch string");
+        std::string str(len, '\0');
+        s.read(&str[0], static_cast<std::streamsize>(len));
+        return str;
+    }
+
+    template<typename T>
+    static void writeCacheEntry(std::ostream &s, const T &v, bool) {
+        s << v;
+    }
+
+    static void writeCacheEntry(std::ostream &s, const series &v, bool compress) {
+        writeSeries(s, v, compress);
+    }
+
+    static void writeCacheEntry(std::ostream &s, const grouped_batch &b, bool compress) {
+        _write(s, b.series_.size());
+        for (auto &r : b.series_) {
+            _write(s, r.tagIds.size() / 2);
+            for (auto id : r.tagIds) _writeString(s, b.dict.str(id));
+            writeSeries(s, r, compress);
+        }
+    }
+
+    static std::ostream &operator<<(std::ostream &s, const grouped_batch &b) {
+        writeCacheEntry(s, b, false);
+        return s;
+    }
+
+    static std::istream &operator>>(std::istream &s, grouped_batch &b) {
+        size_t n = 0;
+        _readVal(s, n);
+        if (!s.good() || n > (1u << 24u)) throw std::runtime_error("invalid grouped_batch header");
+        b.series_.clear();
+        b.series_.resize(n);
+        for (auto &r : b.series_) {
+            size_t numTags = 0;
+            _readVal(s, numTags);
+            for (size_t i = 0; i < 2 * numTags; ++i) r.tagIds.push_back(b.dict.intern(_readString(s)));
+            tag_dict::normalize(r.tagIds);
+            s >> r;
+        }
+        return s;
+    }
+
+    /**
+     * Persistent key -> T store, one file per key (named by a 128-bit fingerprint of the key) in a two-level
+     * directory tree. T is (de)serialized with operator<< and operator>>. Entries are written to a temporary file
+     * and renamed, so readers (also in other processes) never see a partial entry. With `compress`, series are
+     * written gorilla encoded (see gorilla.h); readers accept both.
+     *
+     * Lookups go through the cache_index of the directory, only hits touch the filesystem. The index also bounds the
+     * directory size and packs small entries into segment files, see cache_index::setLimits().
+     */
     template<typename T>
     class file_cache {
+        typedef cache_index::key_type key_type;
 
-        static int mkdir(std::string dir) {
-#ifdef WIN32
-            return ::mkdir(dir.c_str());
-#else
-            return ::mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-#endif
+        static key_type fingerprint(const std::string &key) {
+            auto fp = ::util::Fingerprint128(key);
+            return {fp.first, fp.second};
         }
 
-        static std::string fingerprint128_base64(const std::string &key) {
-            auto fp = ::util::Fingerprint128(key);
-            auto b1 = base64_encode(reinterpret_cast<const unsigned char *>(&fp.first), 8);
-            auto b2 = base64_encode(reinterpret_cast<const unsigned char *>(&fp.second), 8);
-            auto b = b1.substr(0, b1.length() - 1) + b2.substr(0, b2.length() - 1);
-            std::replace(b.begin(), b.end(), '+', '-');
-            std::replace(b.begin(), b.end(), '/', '_');
-            return b;
+        static std::shared_ptr<cache_index> openIndex(const std::string &dir) {
+            cache_index::mkdir(dir);
+            return cache_index::open(dir);
         }
 
-        std::pair<std::string, std::string> dirAndFile(const std::string &key) const {
-            auto b64 = fingerprint128_base64(key);
-            auto d = dir + '/' + b64.substr(0, 2);
-            return {d, d + '/' + b64.substr(2)};
+        /**
+         * Opens the file of an entry at its offset, retrying once if compaction or eviction moved it meanwhile.
+         */
+        template<class Open>
+        bool open(const key_type &fp, Open &&o) const {
+            for (int attempt = 0;; ++attempt) {
+                cache_index::entry e{};
+                if (!index->find(fp, e)) return false;
+                if (o(index->path(fp, e), e)) return true;
+                if (attempt == 0) index->refresh();
+                else {
+                    index->remove(fp, e); // deleted behind our back
+                    return false;
+                }
+            }
         }
 
     public:
         const std::string dir;
+        const bool compress;
+        const std::shared_ptr<cache_index> index;
 
-        explicit file_cache(std::string dir) : dir{dir} {
-            mkdir(dir.c_str());
+        explicit file_cache(std::string dir, bool compress = false)
+                : dir{dir}, compress{compress}, index{openIndex(dir)} {
         }
 
         bool get(std::string key, T &v) const {
-            auto df = dirAndFile(key);
-            std::ifstream f(df.second);
-            if (!f.good()) return false;
-            f >> v;
-            return true;
+            return open(fingerprint(key), [&v](const std::string &path, const cache_index::entry &e) {
+                std::ifstream f(path, std::ios::binary);
+                if (!f.good()) return false;
+                if (e.segment) f.seekg(static_cast<std::streamoff>(e.offset));
+                f >> v;
+                return true;
+            });
         }
 
         bool have(std::string key) const {
-            auto df = dirAndFile(key);
-            std::ifstream f(df.second);
-           // LOG_W << "have:" << LOG_EXPR(key) << LOG_EXPR(df.second) << LOG_EXPR(f.good());
-            return f.good();
+            cache_index::entry e{};
+            return index->find(fingerprint(key), e);
         }
 
-        std::future<bool> get_async(std::string key, T &v) const {
-            auto df = dirAndFile(key);
-            return std::move(std::async(std::launch::async, [df, &v]() {
-                std::ifstream f(df.second);
-                if (!f.good()) return false;
-                f >> v;
+        /**
+         * Maps the entry of a series cache (see mapped_series), nullptr if there is none. Throws if it is invalid.
+         */
+        std::unique_ptr<mapped_series> map(const std::string &key, bool verify = true) const {
+            std::unique_ptr<mapped_series> m;
+            open(fingerprint(key), [&m, verify](const std::string &path, const cache_index::entry &e) {
+                if (!std::ifstream(path).good()) return false;
+                m = std::make_unique<mapped_series>(path, static_cast<size_t>(e.offset), verify);
                 return true;
-            }));
+            });
+            return m;
+        }
+
+        std::future<bool> get_async(std::string key, T &v) const {
+            return std::async(std::launch::async, [self = *this, key, &v]() { return self.get(key, v); });
         }
 
         std::future<void> get_async_throw(std::string key, T &v) const {
-            auto df = dirAndFile(key);
-            return std::move(std::async(std::launch::async, [df, &v]() {
-                std::ifstream f(df.second);
-                //LOG_W << "reading" << df.second;
-                if (!f.good()) throw std::runtime_error("not found in file cache");
-                f >> v;
-            }));
+            return std::async(std::launch::async, [self = *this, key, &v]() {
+                if (!self.get(key, v)) throw std::runtime_error("not found in file cache");
+            });
         }
 
-        void set(const std::string & key, const T &v) const {
+        /**
+         * Writes an entry. The entries of one query share a `group`, the index packs them into one segment file.
+         */
+        void set(const std::string & key, const T &v, uint64_t group = 0) const {
             //LOG_D << "set:" << LOG_EXPR(key);
-            auto df = dirAndFile(key);
-          //  std::cout << df.second << std::endl;
-            std::ofstream f(df.second);
-            if (!f.good()) {
-                mkdir(df.first.c_str());
-                f.open(df.second);
-                if (!f.good()) throw std::runtime_error("cant open " + df.second + " for writing");
+            auto fp = fingerprint(key);
+            auto df = index->dirAndFile(fp);
+            if (index->firstUse(df.first)) cache_index::mkdir(df.first);
+            // unique among threads and processes writing the same key
+            auto tmp = df.second + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()))
+                       + "-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+            std::ofstream f(tmp, std::ios::binary);
+            if (!f.good()) { // removed since
+                cache_index::mkdir(df.first);
+                f.open(tmp, std::ios::binary);
+                if (!f.good()) throw std::runtime_error("cant open " + tmp + " for writing");
             }
             //LOG_W << "\nwriting " << df.second << "\nkey=" << key;
-            f << v;
-            if (!f.good()) throw std::runtime_error("write failure with " + df.second);
+            writeCacheEntry(f, v, compress);
+            auto size = static_cast<uint64_t>(f.tellp());
+            f.close();
+            if (!f.good()) {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("write failure with " + df.second);
+            }
+            index->pending(static_cast<int64_t>(size)); // the temp file, until it is indexed
+#ifdef _WIN32
+            std::remove(df.second.c_str()); // rename does not replace on windows, elsewhere it replaces atomically
+#endif
+            if (std::rename(tmp.c_str(), df.second.c_str()) != 0) {
+                std::remove(tmp.c_str());
+                index->pending(-static_cast<int64_t>(size));
+                index->remove(fp);
+                throw std::runtime_error("cant rename " + tmp);
+            }
+            try {
+                index->add(fp, size, group);
+            } catch (...) {
+                index->pending(-static_cast<int64_t>(size));
+                throw;
+            }
+            index->pending(-static_cast<int64_t>(size));
         }
 
     };
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "client.h"
+#include "scan.h"
+
+namespace influxdb {
+
+    /**
+     * Splits a JSON response into its newline-delimited documents (chunked=true responses are a sequence of
+     * complete documents, a plain response is a single one) and runs a fresh Reader (FastFetchReader, ...) on each.
+     * All documents append to the same series, their columns must match.
+     */
+    template<class Reader>
+    class chunked_json_reader {
+        client::fetchResult &result;
+        std::unique_ptr<Reader> doc{};
+        std::vector<std::string> columns{};
+
+        void endDocument() {
+            if (!doc) return;
+            doc->finish();
+            doc.reset();
+            if (result.columns.empty()) result.columns = columns; // document without series
+            else if (columns.empty()) columns = result.columns;
+            else if (result.columns != columns) throw std::runtime_error("chunked response: columns changed");
+        }
+
+    public:
+        explicit chunked_json_reader(client::fetchResult &res) : result(res) {}
+
+        void feed(const char *p, size_t len) {
+            const char *end = p + len;
+            while (p < end) {
+                auto nl = scan::findByte(p, end, '\n');
+                auto e = nl ? nl : end;
+                if (!doc) {
+                    while (p < e && (*p == ' ' || *p == '\r' || *p == '\t')) ++p;
+                    if (p < e) doc = std::make_unique<Reader>(result);
+                }
+                if (p < e) doc->feed(p, static_cast<size_t>(e - p));
+                if (!nl) break;
+                endDocument();
+                p = nl + 1;
+            }
+        }
+
+        void finish() { endDocument(); }
+    };
+
+    /**
+     * SAX filter for a sequence of top-level documents (chunked msgpack responses). When Handler returns false, the
+     * rest of the current document is skipped and the next document is passed to Handler again.
+     */
+    template<class Handler>
+    class documents_filter {
+        Handler &handler;
+        size_t depth = 0;
+        bool skip = false;
+
+        bool pass(bool ok) {
+            if (!ok) skip = true;
+            if (depth == 0) skip = false;
+            return true;
+        }
+
+    public:
+        explicit documents_filter(Handler &handler) : handler(handler) {}
+
+        bool Null() { return skip ? pass(true) : pass(handler.Null()); }
+
+        bool Bool(bool b) { return skip ? pass(true) : pass(handler.Bool(b)); }
+
+        bool Int(int i) { return skip ? pass(true) : pass(handler.Int(i)); }
+
+        bool Uint(unsigned u) { return skip ? pass(true) : pass(handler.Uint(u)); }
+
+        bool Int64(int64_t i) { return skip ? pass(true) : pass(handler.Int64(i)); }
+
+        bool Uint64(uint64_t u) { return skip ? pass(true) : pass(handler.Uint64(u)); }
+
+        bool Double(double d) { return skip ? pass(true) : pass(handler.Double(d)); }
+
+        bool String(const char *str, rapidjson::SizeType length, bool copy) {
+            return skip ? pass(true) : pass(handler.String(str, length, copy));
+        }
+
+        bool Key(const char *str, rapidjson::SizeType length, bool copy) {
+            return skip ? pass(true) : pass(handler.Key(str, length, copy));
+        }
+
+        bool StartObject() {
+            ++depth;
+            return skip ? pass(true) : pass(handler.StartObject());
+        }
+
+        bool EndObject(rapidjson::SizeType memberCount) {
+            --depth;
+            return skip ? pass(true) : pass(handler.EndObject(memberCount));
+        }
+
+        bool StartArray() {
+            ++depth;
+            return skip ? pass(true) : pass(handler.StartArray());
+        }
+
+        bool EndArray(rapidjson::SizeType elementCount) {
+            --depth;
+            return skip ? pass(true) : pass(handler.EndArray(elementCount));
+        }
+    };
+}
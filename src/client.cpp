@@ -3,13 +3,19 @@
 #endif
 
 #include <evpp/event_loop_thread.h> // overrides errno!
+#include <evpp/event_loop.h>
 #include <evpp/httpc/conn_pool.h>
 #include <evpp/httpc/request.h>
 #include <evpp/httpc/response.h>
+#include <evpp/httpc/conn.h>
+
+#include <event2/buffer.h>
+#include <event2/http.h>
 
 #include <cmath>
 #include <future>
 #include <array>
+#include <deque>
 
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
@@ -17,8 +23,16 @@
 
 #include "client.h"
 #include "json-readers.h"
+#include "json-stream.h"
+#include "json-fast.h"
+#include "msgpack-stream.h"
+#include "csv-reader.h"
+#include "chunked.h"
+#include "tag-dict.h"
 #include "util.h"
 #include "cache.h"
+#include "admission.h"
+#include "retry.h"
 
 
 date::sys_time<std::chrono::milliseconds>
@@ -49,7 +63,10 @@ void throwQueryError(rapidjson::Document &d, const std::string &sql) {
 
 typedef std::shared_ptr<evpp::httpc::Response> t_resp;
 struct queryHandlerArgs {
-    std::atomic<int> &numPending;
+    influxdb::admission_queue &admission;
+    influxdb::circuit_breaker &breaker;
+    std::shared_ptr<influxdb::retry_budget> budget;
+    evpp::EventLoop *loop;
     std::string sql;
     evpp::httpc::GetRequest req;
     std::shared_ptr<std::promise<void>> promise;
@@ -57,27 +74,90 @@ struct queryHandlerArgs {
     int retry;
 };
 
-void queryResultHandler(const t_resp &response, queryHandlerArgs *args) {
-    using namespace std::chrono_literals;
+struct streamHandlerArgs {
+    influxdb::admission_queue &admission;
+    influxdb::circuit_breaker &breaker;
+    std::shared_ptr<influxdb::retry_budget> budget;
+    evpp::EventLoop *loop;
+    std::string sql;
+    evpp::httpc::ConnPool *pool;
+    std::string path;
+    std::string accept;
+    std::shared_ptr<std::promise<void>> promise;
+    influxdb::stream_handler handler;
+    int retry;
+
+    evpp::httpc::ConnPtr conn{};
+    bool begun = false;
+    std::string errorBody{};
+    std::exception_ptr handlerError{};
+};
+
+void queryResultHandler(const t_resp &response, queryHandlerArgs *args);
+
+void startStream(streamHandlerArgs *args);
 
-    --args->numPending;
+void dispatchQuery(queryHandlerArgs *args) {
+    args->req.Execute(std::bind(queryResultHandler, std::placeholders::_1, args));
+}
+
+void dispatchQuery(streamHandlerArgs *args) {
+    args->loop->RunInLoop([args]() { startStream(args); });
+}
+
+template<class Args>
+void failQuery(Args *args, std::exception_ptr e) {
+    args->promise->set_exception(e);
+    delete args;
+}
+
+template<class Args>
+void executeQuery(Args *args) {
+    if (!args->breaker.allow()) {
+        failQuery(args, std::make_exception_ptr(std::runtime_error(
+                "influxdb circuit breaker open (server down?), query \"" + args->sql + "\"")));
+        return;
+    }
+    try {
+        args->admission.submit([args]() { dispatchQuery(args); },
+                               [args](std::exception_ptr e) { failQuery(args, std::move(e)); });
+    } catch (...) {
+        failQuery(args, std::current_exception());
+    }
+}
+
+/**
+ * Re-arms a failed request on an event loop timer if the error is transient and retries are left.
+ */
+template<class Args>
+bool maybeRetry(Args *args, int hc) {
+    bool transient = hc == 0 || hc == 429 || hc >= 500;
+    if (transient) args->breaker.failure();
+    if (!transient || args->retry >= influxdb::MaxRetries || (args->budget && !args->budget->take()))
+        return false;
+
+    auto delay = influxdb::retryDelay(args->retry++);
+    std::cerr << "influxdb http error " << hc << " with query \"" << args->sql << "\", retry " << args->retry
+              << " in " << delay.count() << "ms" << std::endl;
+    // never block the event loop
+    args->loop->RunAfter(evpp::Duration(delay.count() / 1000.0), [args]() { executeQuery(args); });
+    return true;
+}
+
+void queryResultHandler(const t_resp &response, queryHandlerArgs *args) {
+    // free the slot before parsing (or waiting for a retry), so queued requests can start
+    args->admission.release();
 
     auto hc = response->http_code();
     try {
         if (hc != 200) {
-            if (args->retry < 7) {
-                std::cerr << "influxdb http error " << hc << " with query \"" << args->sql << "\" request http://"
-                          << args->req.host() << ":"
-                          << args->req.port() << args->req.uri() << ", retry " << args->retry << std::endl;
-                std::this_thread::sleep_for(200ms * std::pow(2, args->retry++));
-                args->req.Execute(std::bind(queryResultHandler, std::placeholders::_1, args));
-                return;
-            }
+            if (maybeRetry(args, hc)) return;
             std::cerr << "influxdb http error " << hc << ": " << response->body().ToString() << std::endl
                       << "Query: " << args->sql << std::endl;
             throw std::runtime_error(
                     "influxdb http error " + std::to_string(hc) + " " + response->body().ToString());
         }
+        args->breaker.success();
         // auto date(util::parseHttpDate(response->FindHeader("Date")));
         // LOG_I << "server-data:" << util::to8601(date);
         args->callback(response->body().data(), response->body().size());
@@ -88,6 +168,86 @@ void queryResultHandler(const t_resp &response, queryHandlerArgs *args) {
     delete args;
 };
 
+void streamChunkHandler(struct evhttp_request *req, void *arg) {
+    auto args = static_cast<streamHandlerArgs *>(arg);
+    auto in = evhttp_request_get_input_buffer(req);
+    auto n = evbuffer_peek(in, -1, nullptr, nullptr, 0);
+    if (n <= 0) return;
+    std::vector<evbuffer_iovec> vec(static_cast<size_t>(n));
+    evbuffer_peek(in, -1, nullptr, vec.data(), n);
+
+    if (evhttp_request_get_response_code(req) != 200) {
+        for (auto &v : vec) args->errorBody.append(static_cast<const char *>(v.iov_base), v.iov_len);
+        return;
+    }
+
+    if (args->handlerError) return;
+    try {
+        if (!args->begun) {
+            args->begun = true;
+            args->handler.begin();
+        }
+        for (auto &v : vec) args->handler.chunk(static_cast<const char *>(v.iov_base), v.iov_len);
+    } catch (...) {
+        args->handlerError = std::current_exception();
+    }
+    // libevent drains the input buffer after this callback
+}
+
+void streamDoneHandler(struct evhttp_request *req, void *arg) {
+    auto args = static_cast<streamHandlerArgs *>(arg);
+    args->admission.release();
+
+    int hc = req ? evhttp_request_get_response_code(req) : 0;
+    if (req && evbuffer_get_length(evhttp_request_get_input_buffer(req)) > 0)
+        streamChunkHandler(req, arg);
+
+    if (args->conn) {
+        if (hc != 0) args->pool->Put(args->conn);
+        args->conn.reset();
+    }
+
+    try {
+        if (hc != 200) {
+            if (maybeRetry(args, hc)) return;
+            std::cerr << "influxdb http error " << hc << ": " << args->errorBody << std::endl
+                      << "Query: " << args->sql << std::endl;
+            throw std::runtime_error("influxdb http error " + std::to_string(hc) + " " + args->errorBody);
+        }
+        args->breaker.success();
+        if (args->handlerError) std::rethrow_exception(args->handlerError);
+        if (!args->begun) args->handler.begin(); // empty body
+        args->handler.end();
+        args->promise->set_value();
+    } catch (...) {
+        args->promise->set_exception(std::current_exception());
+    }
+    delete args;
+}
+
+void startStream(streamHandlerArgs *args) {
+    args->begun = false;
+    args->errorBody.clear();
+    args->handlerError = nullptr;
+
+    args->conn = args->pool->Get(args->loop);
+    if (!args->conn->Init()) {
+        args->conn.reset();
+        streamDoneHandler(nullptr, args);
+        return;
+    }
+
+    auto req = evhttp_request_new(streamDoneHandler, args);
+    evhttp_request_set_chunked_cb(req, streamChunkHandler);
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Host", args->conn->host().c_str());
+    if (!args->accept.empty())
+        evhttp_add_header(evhttp_request_get_output_headers(req), "Accept", args->accept.c_str());
+    if (evhttp_make_request(args->conn->evhttp_conn(), req, EVHTTP_REQ_GET, args->path.c_str()) != 0) {
+        args->conn.reset();
+        streamDoneHandler(nullptr, args);
+    }
+}
+
 
 namespace influxdb {
 
@@ -98,50 +258,247 @@ namespace influxdb {
     }
 
     client::client(const std::string &host, int port, const std::string &dbName, std::chrono::milliseconds batchTime,
-                   size_t connPoolSize) : dbName(dbName), connPoolSize(connPoolSize) {
+                   size_t connPoolSize)
+            : server(host + ":" + std::to_string(port)), dbName(dbName), connPoolSize(connPoolSize) {
         wsaStart();
         pool = std::make_unique<evpp::httpc::ConnPool>(host, port,
                                                        evpp::Duration(static_cast<double >(RequestTimeoutSeconds)),
                                                        connPoolSize);
         t = std::make_unique<evpp::EventLoopThread>();
         t->Start(true);
+        admission = std::make_unique<admission_queue>(connPoolSize, MaxQueuedRequests);
+        breaker = std::make_unique<circuit_breaker>(CircuitBreakerThreshold, CircuitBreakerCooldown);
         this->batchTime = batchTime;
     }
 
     client::~client() {
         pool->Clear();
+        // requests still waiting for admission fail when `admission` is destroyed below, after the loop stopped
         t->Stop(true);
+        // joined here rather than at static destruction, the next fetch() of another client on the directory
+        // restarts it
+        if (cacheLimits && !cacheDir.empty()) cache_index::stopMaintenance(cacheDir);
+    }
+
+    void client::setGlobalConcurrencyLimit(size_t limit) {
+        admission_queue::setGlobalLimit(limit);
     }
 
 
-    auto sortedMergeGrouped(const std::vector<std::vector<series>> &batches, const TagsKeyFunc &keyFunc)
+    /**
+     * Waits for all futures, then rethrows the first exception (in vector order) if any failed.
+     */
+    static void waitAll(std::vector<std::future<void>> &futs, const char *what) {
+        std::exception_ptr firstException = nullptr;
+        for (auto &fut:futs) {
+            if (!fut.valid()) continue; // never started
+            try {
+                fut.get();
+            } catch (const std::runtime_error &re) {
+                if (!firstException) {
+                    LOG_E << what << " error: " << re.what();
+                    firstException = std::current_exception();
+                }
+            } catch (...) {
+                if (!firstException) {
+                    firstException = std::current_exception();
+                }
+            }
+        }
+
+        if (firstException) {
+            std::rethrow_exception(firstException);
+        }
+    }
+
+    /**
+     * Groups the series of all batches on their interned tags (hashed id vectors, no strings involved), then calls
+     * keyFunc once per distinct tag set and merges the groups with equal keys. Groups are merged concurrently by
+     * up to hardware_concurrency workers.
+     */
+    auto sortedMergeGrouped(std::vector<std::vector<series>> &batches, const tag_dict &dict,
+                            const TagsKeyFunc &keyFunc)
     -> std::unordered_map<std::string, series> {
 
-        std::unordered_map<std::string, std::vector<series>> grouped;
+        std::unordered_map<tag_ids, std::vector<series>, tag_ids_hash> byTags;
         for (auto &batch:batches) {
             for (auto &r:batch) {
-                auto key = keyFunc(r.tags);
-                auto f = grouped.find(key);
-                if (f == grouped.end()) {
-                    f = grouped.emplace(key, std::vector<series>{}).first;
-                }
-                f->second.emplace_back(std::move(r));
+                auto &group(byTags[r.tagIds]);
+                group.emplace_back(std::move(r));
             }
         }
 
-        std::unordered_map<std::string, series> merged;
-        for (auto &kv:grouped) {
-            merged.emplace(kv.first, series::sortedMerge(kv.second));
+        struct group {
+            const tag_ids *tags;
+            std::vector<series> parts;
+            series merged;
+        };
+        std::unordered_map<std::string, group> grouped;
+        for (auto &kv:byTags) {
+            auto &g(grouped.emplace(keyFunc(dict.tags(kv.first)), group{&kv.first, {}, {}}).first->second);
+            std::move(kv.second.begin(), kv.second.end(), std::back_inserter(g.parts));
         }
 
+        std::vector<group *> work;
+        for (auto &kv:grouped) work.push_back(&kv.second);
+        std::atomic<size_t> next{0};
+        auto merge = [&]() {
+            for (size_t i; (i = next++) < work.size();) {
+                auto &g(*work[i]);
+                g.merged = series::sortedMerge(g.parts);
+                g.merged.tagIds = *g.tags;
+                g.merged.tags = dict.tags(g.merged.tagIds);
+            }
+        };
+        std::vector<std::future<void>> workers;
+        auto numWorkers = std::min<size_t>(work.size(), std::max(1u, std::thread::hardware_concurrency()));
+        for (size_t w = 0; w < numWorkers; ++w) workers.emplace_back(std::async(std::launch::async, merge));
+        waitAll(workers, "sortedMergeGrouped");
+
+        std::unordered_map<std::string, series> merged;
+        for (auto &kv:grouped) merged.emplace(kv.first, std::move(kv.second.merged));
         return merged;
     }
 
+    /**
+     * FetchReader on a (chunked) msgpack response, same interface as FastFetchReader.
+     */
+    struct msgpackFetchReader {
+        FetchReader reader;
+        documents_filter<FetchReader> filter{reader};
+        msgpack_stream<documents_filter<FetchReader>> stream{filter};
+
+        explicit msgpackFetchReader(fetchResult &result) : reader(result) {}
+
+        void feed(const char *p, size_t len) { stream.feed(p, len); }
+
+        void finish() { stream.finish(); }
+    };
+
+    /**
+     * Parses a fetch() batch response in a single pass while it streams in.
+     */
+    template<class Reader>
+    struct batchStream {
+        fetchResult &result;
+        Reader reader;
+
+        explicit batchStream(fetchResult &result) : result(result), reader(result) {
+            result.clear();
+            result.columns.clear();
+        }
+
+        void chunk(const char *p, size_t len) {
+            reader.feed(p, len);
+        }
+
+        void end() {
+            reader.finish();
+            if (result.columns.empty()) return; // no series
+
+            result.dataStride = (result.columns.size() - 1);
+            if (result.data.size() % result.dataStride) {
+                throw std::runtime_error("unexpected data len");
+            }
+            result.num = result.data.size() / result.dataStride;
+
+            result.checkNum();
+            result.compactTime(); // GROUP BY time() results
+        }
+
+        /**
+         * `done` is called (on the event loop) once the batch is complete.
+         */
+        static stream_handler handler(fetchResult &result, std::function<void()> &&done) {
+            auto bs = std::make_shared<std::unique_ptr<batchStream>>();
+            return {
+                    [bs, &result]() { *bs = std::make_unique<batchStream>(result); },
+                    [bs](const char *p, size_t len) { (*bs)->chunk(p, len); },
+                    [bs, done]() {
+                        (*bs)->end();
+                        bs->reset();
+                        done();
+                    }
+            };
+        }
+    };
+
+    static stream_handler batchHandler(response_format format, fetchResult &result, std::function<void()> &&done) {
+        switch (format) {
+            case response_format::msgpack:
+                return batchStream<msgpackFetchReader>::handler(result, std::move(done));
+            case response_format::csv:
+                return batchStream<CsvFetchReader>::handler(result, std::move(done));
+            default:
+                return batchStream<chunked_json_reader<FastFetchReader>>::handler(result, std::move(done));
+        }
+    }
+
     void maybeFixTimeRange(std::array<std::string, 2> &timeRange) {
         if (timeRange[0].find('T') == std::string::npos) timeRange[0] += "T00:00:00.000Z";
         if (timeRange[1].find('T') == std::string::npos) timeRange[1] += "T00:00:00.000Z";
     }
 
+    std::string client::cacheKey(const std::string &kind, const std::string &sql) const {
+        return kind + "\n" + server + "\n" + dbName + "\n" + sql;
+    }
+
+    /**
+     * Reads a cache entry, false if it is missing or unreadable (a partially read `v` must be discarded).
+     */
+    template<class T>
+    static bool cacheGet(const file_cache<T> &cache, const std::string &key, T &v) {
+        try {
+            return cache.get(key, v);
+        } catch (const std::exception &e) {
+            LOG_W << "cache read failed, refetching: " << e.what();
+            return false;
+        }
+    }
+
+    /**
+     * Maps a cached fetch() batch (see mapped_series), nullptr if it is missing or unreadable.
+     */
+    static std::unique_ptr<mapped_series> cacheMap(const file_cache<fetchResult> &cache, const std::string &key) {
+        try {
+            return cache.map(key);
+        } catch (const std::exception &e) {
+            LOG_W << "cache read failed, refetching: " << e.what();
+            return nullptr;
+        }
+    }
+
+    /**
+     * Writes a cache entry. A failing cache must not fail the query, so errors are only logged.
+     */
+    template<class T>
+    static void cacheSet(const file_cache<T> &cache, const std::string &key, const T &v, uint64_t group) {
+        try {
+            cache.set(key, v, group);
+        } catch (const std::exception &e) {
+            LOG_W << "cache write failed: " << e.what();
+        }
+    }
+
+    /**
+     * The file cache of `dir` (nullptr if it is empty), starting maintenance of the directory if there are limits.
+     */
+    template<class T>
+    static std::unique_ptr<file_cache<T>>
+    openCache(const std::string &dir, bool compress, const std::unique_ptr<cache_limits> &limits) {
+        if (dir.empty()) return nullptr;
+        auto cache = std::make_unique<file_cache<T>>(dir, compress);
+        if (limits) cache->index->setLimits(*limits);
+        return cache;
+    }
+
+    /**
+     * Batches of one query share a group in the cache, see file_cache::set().
+     */
+    static uint64_t cacheGroup(const std::string &key) {
+        return ::util::Hash64(key.data(), key.size());
+    }
+
     client::fetchResult
     client::fetch(const std::string &sql, std::array<std::string, 2> timeRange,
                   const std::vector<std::string> &&args) {
@@ -159,10 +516,40 @@ namespace influxdb {
         auto fsql = sqlArgs(sql, args);
 
         std::vector<std::future<void>> futs;
-        std::vector<std::string> columns;
         std::vector<fetchResult> results{batches};
 
-        std::mutex mtxColumns;
+        // batches are appended to the merged series as soon as all earlier ones are complete (on the event loop) and
+        // freed right away, the first one without copying, so there is no concatenation at the end. When merged has
+        // to grow, it is reserved for the rows expected of all batches (extrapolated from the ones so far, batches
+        // span equal time), so it is reallocated about once instead of doubling. Cached batches are read on other
+        // threads, so assembling is serialized. Uncompressed cache hits stay mapped until their turn and are copied
+        // from the file straight into merged.
+        fetchResult merged{};
+        std::vector<std::unique_ptr<mapped_series>> mapped(batches);
+        std::vector<bool> batchDone(batches, false);
+        size_t nextBatch = 0;
+        std::mutex assembleMtx;
+        auto assemble = [&](size_t bi) {
+            std::lock_guard<std::mutex> lock(assembleMtx);
+            batchDone[bi] = true;
+            for (; nextBatch < batches && batchDone[nextBatch]; ++nextBatch) {
+                auto &m = mapped[nextBatch];
+                auto need = merged.num + (m ? m->view().num : results[nextBatch].num);
+                if (merged.num && need > merged.capacity())
+                    merged.reserve(std::max(need * batches / (nextBatch + 1), need + need / 4));
+                if (m) {
+                    merged.append(m->view());
+                    m.reset();
+                } else {
+                    merged.append(std::move(results[nextBatch]));
+                }
+            }
+        };
+
+        auto budget = std::make_shared<retry_budget>(FetchRetryBudget);
+        auto cache = openCache<fetchResult>(cacheDir, cacheCompress, cacheLimits);
+        auto group = cache ? cacheGroup(cacheKey("fetch", fsql)) : 0;
+        std::vector<std::future<void>> writes(batches); // each slot set by the done callback of its batch
 
         for (int bi = 0; bi < batches; ++bi) {
             auto bsql = fsql;
@@ -179,73 +566,88 @@ namespace influxdb {
             );
 
             // LOG_D << "f:" << LOG_EXPR(bsql);
-            //file_cache<fetchResult> cache{"influx-cache"};
-            futs.emplace_back(
-                    //false && cache.have(bsql)
-                    //? cache.get_async_throw(bsql, results[bi])                  :
-                    queryRaw(bsql,
-                             [&mtxColumns, &columns, &results, bi, bsql /*, &cache*/]
-                                     (const char *body, size_t len) {
-                                 rapidjson::Reader reader;
-
-                                 //LOG_D << "body:" << std::string(body);
-
-                                 {
-                                     std::lock_guard<std::mutex> lg{mtxColumns};
-                                     if (columns.size() == 0) {
-                                         ColumnReader colsReader;
-                                         {
-                                             rapidjson::StringStream ss(body);
-                                             reader.Parse(ss, colsReader);
-                                         }
-                                         columns = colsReader.columns;
-                                     }
-                                 }
-
-
-                                 auto &result(results[bi]);
-                                 DataReader dataReader{columns.size(), result};
-                                 rapidjson::StringStream ss(body);
-                                 reader.Parse(ss, dataReader);
-                                 if (result.data.size() % (columns.size() - 1)) {
-                                     throw std::runtime_error("unexpected data len");
-                                 }
-
-                                 result.dataStride = (columns.size() - 1);
-                                 result.num = result.data.size() / result.dataStride;
-                                 result.columns = columns; // copy for cache
-
-                                 result.checkNum();
-                                 //cache.set(bsql, result);
-
-                             }));
-        }
-
-
-        std::exception_ptr firstException = nullptr;
-        for (auto &fut:futs) {
-            try {
-                fut.get();
-            } catch (const std::runtime_error &re) {
-                if (!firstException) {
-                    LOG_E << "fetch error: " << re.what();
-                    firstException = std::current_exception();
-                }
-            } catch (...) {
-                if (!firstException) {
-                    firstException = std::current_exception();
+            bool immutable = cache && bt1 < aMinAgo;
+            auto key = immutable ? cacheKey("fetch", bsql) : std::string{};
+            // `done` runs on the event loop, the cache write (encoding, file io, manifest append) does not
+            std::function<void()> done = [&, bi, key, immutable]() {
+                if (!immutable) {
+                    assemble(bi);
+                    return;
                 }
+                writes[bi] = std::async(std::launch::async, [&, bi, key]() {
+                    cacheSet(*cache, key, results[bi], group);
+                    assemble(bi);
+                });
+            };
+
+            if (immutable && cache->have(key)) {
+                futs.emplace_back(std::async(std::launch::async, [&, bi, key, bsql, done]() mutable {
+                    if (auto m = cacheMap(*cache, key)) {
+                        // a decoded (compressed) entry is moved out, a mapped one read in place
+                        if (m->inPlace()) {
+                            mapped[bi] = std::move(m);
+                        } else {
+                            results[bi] = m->release();
+                            results[bi].compactTime();
+                        }
+                        assemble(bi);
+                    } else {
+                        queryStream(bsql, batchHandler(format, results[bi], std::move(done)), budget).get();
+                    }
+                }));
+                continue;
             }
-        }
 
-        if (firstException) {
-            std::rethrow_exception(firstException);
+            futs.emplace_back(queryStream(bsql, batchHandler(format, results[bi], std::move(done)), budget));
         }
 
-        return series::sortedMerge(results);
+
+        waitAll(futs, "fetch");
+        waitAll(writes, "fetch");
+
+        return merged;
+    }
+
+    static std::string queryPath(const std::string &dbName, const std::string &sql, size_t chunkSize) {
+        auto path = "/query?db=" + dbName + "&epoch=ms";
+        if (chunkSize) path += "&chunked=true&chunk_size=" + std::to_string(chunkSize);
+        return path + "&q=" + util::urlEncode(sql);
     }
 
-    std::future<void> client::queryRaw(const std::string &sql, std::function<void(const char *, size_t)> &&callback) {
+    /**
+     * Calls `callback` with each newline-delimited document of a chunked JSON response.
+     */
+    static stream_handler jsonDocuments(std::function<void(const char *, size_t)> &&callback) {
+        struct state {
+            std::function<void(const char *, size_t)> callback;
+            std::string buf;
+        };
+        auto st = std::make_shared<state>(state{std::move(callback), {}});
+        return {
+                [st]() { st->buf.clear(); },
+                [st](const char *p, size_t len) {
+                    const char *end = p + len;
+                    while (auto nl = scan::findByte(p, end, '\n')) {
+                        if (st->buf.empty()) {
+                            if (nl > p) st->callback(p, static_cast<size_t>(nl - p));
+                        } else {
+                            st->buf.append(p, nl);
+                            st->callback(st->buf.data(), st->buf.size());
+                            st->buf.clear();
+                        }
+                        p = nl + 1;
+                    }
+                    st->buf.append(p, end);
+                },
+                [st]() {
+                    if (!st->buf.empty()) st->callback(st->buf.data(), st->buf.size());
+                    st->buf.clear();
+                }
+        };
+    }
+
+    std::future<void> client::queryRaw(const std::string &sql, std::function<void(const char *, size_t)> &&callback,
+                                       const std::shared_ptr<retry_budget> &budget, size_t chunkSize) {
         typedef std::promise<void> t_promise;
         typedef std::shared_ptr<evpp::httpc::Response> t_resp;
 
@@ -253,7 +655,15 @@ namespace influxdb {
 
         //LOG_D << sql;
         //std::cout << sql << std::endl;
-        auto path = "/query?db=" + dbName + "&epoch=ms&q=" + util::urlEncode(sql);
+        auto path = queryPath(dbName, sql, chunkSize);
+
+        if (chunkSize) {
+            executeQuery(new streamHandlerArgs{
+                    *admission, *breaker, budget, t->loop(),
+                    sql, pool.get(), path, "",
+                    result_promise, jsonDocuments(std::move(callback)), 0,});
+            return result_promise->get_future();
+        }
 
         /*auto req = new evpp::httpc::GetRequest(pool.get(), t->loop(), path);
         //auto rh = new retryHandler{0, nullptr};
@@ -287,27 +697,41 @@ namespace influxdb {
         };
          */
 
-        if (numPendingReq >= connPoolSize) {
-            //LOG_W << LOG_EXPR(numPendingReq);
-            // TODO std::condition_variable cv; cv.wait(lk, []{return ready;});
-            while (numPendingReq > connPoolSize / 2) {
-                std::this_thread::sleep_for(0.1ms + 0.01ms * (std::rand() % 100));
-            }
-        }
-
-        ++numPendingReq;
-        auto handlerArgs = new queryHandlerArgs{
-                numPendingReq,
+        executeQuery(new queryHandlerArgs{
+                *admission, *breaker, budget, t->loop(),
                 sql,
                 evpp::httpc::GetRequest{pool.get(), t->loop(), path},
-                result_promise, callback, 0,};
-        handlerArgs->req.Execute(std::bind(queryResultHandler, std::placeholders::_1, handlerArgs));
+                result_promise, callback, 0,});
 
         //req->Execute(handler);
 
         return std::move(result_promise->get_future());
     }
 
+    static const char *acceptHeader(response_format format) {
+        switch (format) {
+            case response_format::msgpack:
+                return "application/x-msgpack";
+            case response_format::csv:
+                return "application/csv";
+            default:
+                return "";
+        }
+    }
+
+    std::future<void> client::queryStream(const std::string &sql, stream_handler &&handler,
+                                          const std::shared_ptr<retry_budget> &budget) {
+        auto result_promise = std::make_shared<std::promise<void>>();
+        auto path = queryPath(dbName, sql, chunkSize);
+
+        executeQuery(new streamHandlerArgs{
+                *admission, *breaker, budget, t->loop(),
+                sql, pool.get(), path, acceptHeader(format),
+                result_promise, std::move(handler), 0,});
+
+        return result_promise->get_future();
+    }
+
     static std::string jsonToString(const rapidjson::Value &jv) {
         rapidjson::StringBuffer buffer;
         rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -341,6 +765,31 @@ namespace influxdb {
     }
 
 
+    /**
+     * Parses one fetchGroups() batch (a null-terminated JSON body) into one series per tag set, columns and values
+     * in a single pass.
+     */
+    static void parseGroupedBatch(const char *body, std::vector<series> &batch, std::vector<std::string> &columns,
+                                  tag_dict &dict) {
+        rapidjson::Reader reader;
+        SeriesReader dataReader{batch, &dict};
+        rapidjson::StringStream ss(body);
+        reader.Parse(ss, dataReader);
+        columns.clear();
+        if (batch.empty()) return; // no data in this time range
+
+        columns = batch[0].columns;
+        for (auto &r:batch) {
+            if (r.columns != columns) throw std::runtime_error("fetchGroups: columns differ between series");
+            if (r.data.size() % (columns.size() - 1)) {
+                throw std::runtime_error("unexpected data len");
+            }
+            r.dataStride = (columns.size() - 1);
+            r.num = r.data.size() / r.dataStride;
+            r.checkNum();
+        }
+    }
+
     std::unordered_map<std::string, series>
     client::fetchGroups(const std::string &sql, std::array<std::string, 2> timeRange,
                         const std::vector<std::string> &&args,
@@ -359,8 +808,47 @@ namespace influxdb {
         auto fsql = sqlArgs(sql, args);
 
         std::vector<std::future<void>> futs;
-        std::vector<std::string> columns;
         std::vector<std::vector<series>> batches{numBatches};
+        std::vector<std::vector<std::string>> columns{numBatches};
+        tag_dict dict;
+        auto budget = std::make_shared<retry_budget>(FetchRetryBudget);
+        auto cache = openCache<grouped_batch>(cacheDir, cacheCompress, cacheLimits);
+        auto group = cache ? cacheGroup(cacheKey("fetchGroups", fsql)) : 0;
+        std::vector<std::string> keys(numBatches); // cache keys of the immutable batches
+
+        // bodies are parsed off the event loop by up to hardware_concurrency workers pulling from a queue, so
+        // batches decode in parallel while others are still in flight. queryRaw() only lends the body, it is copied.
+        struct parse_queue {
+            std::mutex mtx;
+            std::deque<std::pair<size_t, std::string>> bodies;
+            size_t workers = 0;
+            std::vector<std::future<void>> futs; // destroyed (joined) before the state the workers use
+        } parsing;
+        const size_t maxParsers = std::max(1u, std::thread::hardware_concurrency());
+        // every batch only touches its own slots (and the thread-safe dict)
+        auto parseWorker = [&parsing, &batches, &columns, &dict, &cache, &keys, group]() {
+            for (;;) {
+                std::pair<size_t, std::string> job;
+                {
+                    std::lock_guard<std::mutex> lock(parsing.mtx);
+                    if (parsing.bodies.empty()) {
+                        --parsing.workers;
+                        return;
+                    }
+                    job = std::move(parsing.bodies.front());
+                    parsing.bodies.pop_front();
+                }
+                auto bi = job.first;
+                try {
+                    parseGroupedBatch(job.second.c_str(), batches[bi], columns[bi], dict);
+                    if (!keys[bi].empty()) cacheSet(*cache, keys[bi], grouped_batch{batches[bi], dict}, group);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(parsing.mtx);
+                    --parsing.workers;
+                    throw;
+                }
+            }
+        };
 
         for (int bi = 0; bi < numBatches; ++bi) {
             auto bsql = fsql;
@@ -376,53 +864,48 @@ namespace influxdb {
                     "(time >= '" + to8601(bt0) + "' AND time " + eo + " '" + to8601(bt1) + "')"
             );
 
-            // LOG_D << "f:" << LOG_EXPR(bsql);
-            //file_cache<fetchResult> cache{"influx-cache"};
-            futs.emplace_back(
-                    //false && cache.have(bsql)
-                    //? cache.get_async_throw(bsql, results[bi])                  :
-                    queryRaw(bsql, [&columns, &batches, bi, bsql /*, &cache*/](const char *body, size_t len) {
-                        rapidjson::Reader reader;
-
-                        //  LOG_D << bsql << " resp body len=" << len;
-
-                        throw "fix race condition!";
-                        if (columns.size() == 0) {
-                            ColumnReader colsReader;
-                            {
-                                rapidjson::StringStream ss(body);
-                                reader.Parse(ss, colsReader);
-                            }
-                            columns = colsReader.columns;
-                        }
+            bool immutable = cache && bt1 < aMinAgo;
+            auto &key(keys[bi]);
+            if (immutable) key = cacheKey("fetchGroups", bsql);
+            std::function<void(const char *, size_t)> queue = [&parsing, &parseWorker, maxParsers, bi](
+                    const char *body, size_t len) {
+                std::lock_guard<std::mutex> lock(parsing.mtx);
+                parsing.bodies.emplace_back(bi, std::string(body, len));
+                if (parsing.workers < maxParsers) {
+                    ++parsing.workers;
+                    parsing.futs.emplace_back(std::async(std::launch::async, parseWorker));
+                }
+            };
+
+            if (immutable && cache->have(key)) {
+                // read and decoded on another thread, the requests of later batches do not wait for the disk. The
+                // hit only writes its own slots
+                futs.emplace_back(std::async(std::launch::async, [&, bi, bsql, queue]() mutable {
+                    grouped_batch cached{batches[bi], dict};
+                    if (cacheGet(*cache, keys[bi], cached)) {
+                        columns[bi] = batches[bi].empty() ? std::vector<std::string>{} : batches[bi][0].columns;
+                        return;
+                    }
+                    batches[bi].clear();
+                    queryRaw(bsql, std::move(queue), budget).get();
+                }));
+                continue;
+            }
 
-                        if (columns.size() != 0) {
-                            auto &batch(batches[bi]);
-                            SeriesReader dataReader{columns.size(), batch};
-                            rapidjson::StringStream ss(body);
-                            reader.Parse(ss, dataReader);
-                            for (auto &r:batch) {
-                                if (r.data.size() % (columns.size() - 1)) {
-                                    throw std::runtime_error("unexpected data len");
-                                }
-                                r.dataStride = (columns.size() - 1);
-                                r.num = r.data.size() / r.dataStride;
-                                r.columns = columns; // copy for cache
-
-                                //if (r.num != r.time.size()) { // TODO
-                                //    throw std::runtime_error("unexpected time len");
-                                //}
-                            }
-
-                            //cache.set(bsql, result);
-                        }
-                    }));
+            futs.emplace_back(queryRaw(bsql, std::move(queue), budget));
         }
 
-        for (auto &fut:futs) fut.get();
+        waitAll(futs, "fetchGroups");
+        waitAll(parsing.futs, "fetchGroups"); // no more bodies are queued once all responses are in
 
-        throw std::logic_error("need exception handling, see fetch()");
+        // all batches must agree on the columns
+        const std::vector<std::string> *cols = nullptr;
+        for (auto &c:columns) {
+            if (c.empty()) continue;
+            if (!cols) cols = &c;
+            else if (c != *cols) throw std::runtime_error("fetchGroups: columns differ between batches");
+        }
 
-        return sortedMergeGrouped(batches, keyFunc);
+        return sortedMergeGrouped(batches, dict, keyFunc);
     }
 }
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "client.h"
+#include "scan.h"
+
+namespace influxdb {
+
+    /**
+     * Decoder for a single series /query response in CSV (Accept: application/csv):
+     *   name,tags,time,v,n
+     *   load,,1529425346000,,0
+     *   load,,1529425348000,0.23,1
+     *
+     * Complete lines of a chunk are decoded in two stages: a SIMD pass builds an index of the separators (, and \n)
+     * outside of quotes, then the fields between them are parsed straight into series::time/series::data.
+     * An empty field is a null and repeats the previous value. Like FetchReader, decoding stops after the first
+     * series (a blank line, a new header or another name/tags prefix).
+     */
+    class CsvFetchReader {
+        enum class State {
+            Header, Rows, Error, Done
+        };
+
+        series &result;
+        State st = State::Header;
+        std::string buf{}; // partial line at the end of the last chunk
+        std::string prefix{}; // name,tags of the first row
+        std::vector<uint32_t> seps{};
+        size_t stride = 0;
+
+        static const char *trimCR(const char *s, const char *e) { return (e > s && e[-1] == '\r') ? e - 1 : e; }
+
+        void parseHeader(const char *p, const char *end) {
+            end = trimCR(p, end);
+            if (p == end) return; // leading blank line
+            std::vector<std::string> fields;
+            for (const char *s = p;;) {
+                auto e = static_cast<const char *>(std::memchr(s, ',', static_cast<size_t>(end - s)));
+                if (!e) e = end;
+                if (e - s >= 2 && *s == '"' && e[-1] == '"') fields.emplace_back(s + 1, e - 1);
+                else fields.emplace_back(s, e);
+                if (e == end) break;
+                s = e + 1;
+            }
+            if (fields.size() == 1 && fields[0] == "error") {
+                st = State::Error;
+                return;
+            }
+            if (fields.size() < 4 || fields[0] != "name" || fields[1] != "tags" || fields[2] != "time")
+                throw std::runtime_error("CsvFetchReader: unexpected header");
+            result.columns.assign(fields.begin() + 2, fields.end());
+            stride = result.columns.size() - 1;
+            st = State::Rows;
+        }
+
+        /**
+         * Stage 1: offsets of , and \n in [p, end) that are not inside a quoted field.
+         */
+        void indexSeparators(const char *p, const char *end) {
+            seps.clear();
+            bool quoted = false;
+            auto add = [&](size_t i) {
+                if (p[i] == '"') quoted = !quoted; // "" escapes toggle twice
+                else if (!quoted) seps.push_back(static_cast<uint32_t>(i));
+            };
+            size_t n = static_cast<size_t>(end - p), i = 0;
+            for (; i + 16 <= n; i += 16) {
+                for (uint32_t m = scan::mask16(p + i, ',', '\n', '"'); m; m &= m - 1) add(i + scan::ctz(m));
+            }
+            for (; i < n; ++i) if (p[i] == ',' || p[i] == '\n' || p[i] == '"') add(i);
+        }
+
+        void parseValue(const char *s, const char *e) {
+            auto &data(result.data);
+            if (s == e) {
+                data.push_back(data.size() < stride ? NAN : data[data.size() - stride]); // repeat previous
+                return;
+            }
+            double d;
+            if (scan::parseNumber(s, e, d) != e) throw std::runtime_error("CsvFetchReader: unexpected value");
+            data.push_back(static_cast<float>(d));
+        }
+
+        /**
+         * Stage 2: walks the separator index, one row per line. Returns false once the series ended.
+         */
+        bool parseRows(const char *p, const char *end) {
+            indexSeparators(p, end);
+            const uint32_t *sep = seps.data(), *sepEnd = sep + seps.size();
+            const char *line = p;
+            while (line < end) {
+                // blank line: end of the series
+                if (*line == '\n' || (*line == '\r' && line + 1 < end && line[1] == '\n')) return false;
+
+                // name, tags
+                if (sepEnd - sep < 3 || p[sep[0]] != ',' || p[sep[1]] != ',')
+                    throw std::runtime_error("CsvFetchReader: unexpected row");
+                const char *timeBegin = p + sep[1] + 1;
+                auto prefixLen = static_cast<size_t>(timeBegin - line);
+                if (prefix.empty()) prefix.assign(line, prefixLen);
+                else if (prefix.size() != prefixLen || std::memcmp(prefix.data(), line, prefixLen) != 0)
+                    return false; // next series
+                sep += 2;
+
+                // time
+                const char *s = timeBegin, *e = p + *sep;
+                bool neg = s < e && *s == '-';
+                if (neg) ++s;
+                if (s == e || !scan::isDigit(*s)) throw std::runtime_error("CsvFetchReader: unexpected time");
+                uint64_t t = 0;
+                for (; s < e && scan::isDigit(*s); ++s) t = t * 10 + static_cast<unsigned>(*s - '0');
+                if (trimCR(s, e) != s) throw std::runtime_error("CsvFetchReader: unexpected time");
+                result.time.push_back(neg ? -static_cast<int64_t>(t) : static_cast<int64_t>(t));
+
+                // values
+                size_t col = 0;
+                while (p[*sep] == ',') {
+                    s = p + *sep + 1;
+                    if (++sep == sepEnd) throw std::runtime_error("CsvFetchReader: unexpected row");
+                    parseValue(s, trimCR(s, p + *sep));
+                    ++col;
+                }
+                if (col != stride) throw std::runtime_error("CsvFetchReader: unexpected row length");
+                line = p + *sep + 1;
+                ++sep;
+            }
+            return true;
+        }
+
+        /**
+         * Decodes the complete lines [p, end), end is just after a \n.
+         */
+        void parseLines(const char *p, const char *end) {
+            while (p < end && st != State::Rows) {
+                auto nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+                if (st == State::Header) parseHeader(p, nl);
+                else if (st == State::Error)
+                    throw std::runtime_error("influxdb error: " + std::string(p, trimCR(p, nl)));
+                else return;
+                p = nl + 1;
+            }
+            if (st == State::Rows && p < end && !parseRows(p, end)) st = State::Done;
+        }
+
+    public:
+        explicit CsvFetchReader(series &res) : result(res) {}
+
+        void feed(const char *chunk, size_t len) {
+            if (st == State::Done) return;
+            const char *p = chunk, *end = chunk + len;
+            if (!buf.empty()) {
+                // complete the partial line of the previous chunk
+                auto nl = static_cast<const char *>(std::memchr(p, '\n', len));
+                if (!nl) {
+                    buf.append(p, len);
+                    return;
+                }
+                buf.append(p, nl + 1);
+                parseLines(buf.data(), buf.data() + buf.size());
+                buf.clear();
+                p = nl + 1;
+                if (st == State::Done) return;
+            }
+            const char *last = end;
+            while (last > p && last[-1] != '\n') --last;
+            parseLines(p, last);
+            if (st != State::Done) buf.assign(last, end);
+        }
+
+        void finish() {
+            if (!buf.empty()) {
+                // last line without newline
+                buf.push_back('\n');
+                parseLines(buf.data(), buf.data() + buf.size());
+                buf.clear();
+            }
+            if (st == State::Error) throw std::runtime_error("influxdb error");
+        }
+    };
+}
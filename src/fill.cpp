@@ -0,0 +1,155 @@
+#include <cmath>
+#include <cstdint>
+
+#include "fill.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INFLUXDB_FILL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(INFLUXDB_FILL_SSE2) && (defined(__GNUC__) || defined(_MSC_VER))
+#define INFLUXDB_FILL_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define INFLUXDB_TARGET_AVX2
+#else
+#define INFLUXDB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace influxdb {
+
+    static inline unsigned popcount(unsigned m) {
+#ifdef _MSC_VER
+        return __popcnt(m);
+#else
+        return static_cast<unsigned>(__builtin_popcount(m));
+#endif
+    }
+
+    /**
+     * Cells [k, end) of the flat matrix, one at a time.
+     */
+    static inline size_t fillRange(float *d, size_t k, size_t end, size_t stride) {
+        size_t filled = 0;
+        for (; k < end; ++k) {
+            if (std::isnan(d[k])) {
+                d[k] = d[k - stride];
+                ++filled;
+            }
+        }
+        return filled;
+    }
+
+    size_t fillForwardScalar(float *data, size_t rows, size_t stride) {
+        if (rows < 2 || stride == 0) return 0;
+        return fillRange(data, stride, rows * stride, stride);
+    }
+
+    /*
+     * The matrix is scanned flat, a vector at a time. Vectors without NaN (the common case) are skipped after one
+     * compare. Otherwise, if the row stride is at least the vector width, the previous row's cells are final already
+     * and the vector is blended with them; narrow rows take the scalar path for that vector.
+     */
+
+#ifdef INFLUXDB_FILL_SSE2
+
+    static size_t fillForwardSse2(float *d, size_t rows, size_t stride) {
+        if (rows < 2 || stride == 0) return 0;
+        size_t filled = 0, k = stride, n = rows * stride;
+        for (; k + 4 <= n; k += 4) {
+            __m128 v = _mm_loadu_ps(d + k);
+            __m128 nan = _mm_cmpunord_ps(v, v);
+            auto m = static_cast<unsigned>(_mm_movemask_ps(nan));
+            if (!m) continue;
+            if (stride >= 4) {
+                __m128 prev = _mm_loadu_ps(d + k - stride);
+                _mm_storeu_ps(d + k, _mm_or_ps(_mm_andnot_ps(nan, v), _mm_and_ps(nan, prev)));
+                filled += popcount(m);
+            } else {
+                filled += fillRange(d, k, k + 4, stride);
+            }
+        }
+        return filled + fillRange(d, k, n, stride);
+    }
+
+#endif
+
+#ifdef INFLUXDB_FILL_AVX2
+
+    INFLUXDB_TARGET_AVX2
+    static size_t fillForwardAvx2(float *d, size_t rows, size_t stride) {
+        if (rows < 2 || stride == 0) return 0;
+        size_t filled = 0, k = stride, n = rows * stride;
+        for (; k + 8 <= n; k += 8) {
+            __m256 v = _mm256_loadu_ps(d + k);
+            __m256 nan = _mm256_cmp_ps(v, v, _CMP_UNORD_Q);
+            auto m = static_cast<unsigned>(_mm256_movemask_ps(nan));
+            if (!m) continue;
+            if (stride >= 8) {
+                _mm256_storeu_ps(d + k, _mm256_blendv_ps(v, _mm256_loadu_ps(d + k - stride), nan));
+                filled += popcount(m);
+            } else if (stride >= 4) {
+                // two halves, the second one may read cells the first one just filled
+                for (size_t h = k; h < k + 8; h += 4) {
+                    __m128 hv = _mm_loadu_ps(d + h);
+                    _mm_storeu_ps(d + h, _mm_blendv_ps(hv, _mm_loadu_ps(d + h - stride), _mm_cmpunord_ps(hv, hv)));
+                }
+                filled += popcount(m);
+            } else {
+                filled += fillRange(d, k, k + 8, stride);
+            }
+        }
+        return filled + fillRange(d, k, n, stride);
+    }
+
+    static bool haveAvx2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+#endif
+
+    typedef size_t (*fill_kernel)(float *, size_t, size_t);
+
+    static fill_kernel selectKernel(const char *&isa) {
+#ifdef INFLUXDB_FILL_AVX2
+        if (haveAvx2()) {
+            isa = "avx2";
+            return fillForwardAvx2;
+        }
+#endif
+#ifdef INFLUXDB_FILL_SSE2
+        isa = "sse2";
+        return fillForwardSse2;
+#else
+        isa = "scalar";
+        return fillForwardScalar;
+#endif
+    }
+
+    static const char *kernelIsa = nullptr;
+
+    static fill_kernel kernel() {
+        static const fill_kernel k = selectKernel(kernelIsa);
+        return k;
+    }
+
+    size_t fillForward(float *data, size_t rows, size_t stride) {
+        return kernel()(data, rows, stride);
+    }
+
+    const char *fillForwardIsa() {
+        kernel();
+        return kernelIsa;
+    }
+}
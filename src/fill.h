@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+namespace influxdb {
+
+    /**
+     * Forward fill of a row-major float matrix: every NaN in row i >= 1 is replaced by the value in the same column
+     * of row i-1 (which is filled already, so NaN runs take the last valid value). Returns the number of filled
+     * cells. Dispatches at runtime to AVX2, SSE2 or scalar code.
+     */
+    size_t fillForward(float *data, size_t rows, size_t stride);
+
+    /**
+     * Scalar reference of fillForward().
+     */
+    size_t fillForwardScalar(float *data, size_t rows, size_t stride);
+
+    /**
+     * Instruction set fillForward() dispatches to: "avx2", "sse2" or "scalar".
+     */
+    const char *fillForwardIsa();
+}
@@ -0,0 +1,204 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "client.h"
+#include "gorilla.h"
+#include "scan.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace influxdb {
+    namespace gorilla {
+
+        // bytes after the last bit, so the decoder may always load 8 bytes and overshoot by one value
+        static constexpr size_t Padding = 16;
+
+        static inline unsigned clz32(uint32_t x) {
+#ifdef _MSC_VER
+            unsigned long i;
+            _BitScanReverse(&i, x);
+            return 31 - i;
+#else
+            return static_cast<unsigned>(__builtin_clz(x));
+#endif
+        }
+
+        static inline uint64_t loadBE64(const char *p) {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+#ifdef _MSC_VER
+            return _byteswap_uint64(v);
+#else
+            return __builtin_bswap64(v);
+#endif
+        }
+
+        static inline uint64_t zigzag(int64_t v) {
+            return (static_cast<uint64_t>(v) << 1u) ^ static_cast<uint64_t>(v >> 63);
+        }
+
+        static inline int64_t unzigzag(uint64_t z) {
+            return static_cast<int64_t>(z >> 1u) ^ -static_cast<int64_t>(z & 1u);
+        }
+
+        struct bit_writer {
+            std::string &out;
+            uint64_t acc = 0;
+            unsigned bits = 0; // pending bits in acc, < 8 between calls
+
+            void put(uint64_t v, unsigned n) { // n <= 32
+                acc = (acc << n) | (v & ((1ull << n) - 1));
+                bits += n;
+                while (bits >= 8) {
+                    bits -= 8;
+                    out.push_back(static_cast<char>(acc >> bits));
+                }
+            }
+
+            void put64(uint64_t v) {
+                put(v >> 32u, 32);
+                put(v, 32);
+            }
+
+            void finish() {
+                if (bits) put(0, 8 - bits);
+                out.append(Padding, '\0');
+            }
+        };
+
+        struct bit_reader {
+            const char *p;
+            size_t pos = 0; // in bits
+
+            inline uint64_t peek(unsigned n) const { // 1 <= n <= 32
+                return (loadBE64(p + (pos >> 3u)) << (pos & 7u)) >> (64u - n);
+            }
+
+            inline uint64_t read(unsigned n) {
+                auto v = peek(n);
+                pos += n;
+                return v;
+            }
+
+            inline uint64_t read64() {
+                auto hi = read(32);
+                return (hi << 32u) | read(32);
+            }
+        };
+
+        // delta-of-delta buckets: control prefix, then the zigzag encoded value
+        struct dod_bucket {
+            uint8_t prefixLen;
+            uint8_t valueBits;
+        };
+
+        // indexed by the next 4 bits: 0xxx, 10xx, 110x, 1110, 1111
+        static constexpr dod_bucket dodBuckets[16] = {
+                {1, 0}, {1, 0}, {1, 0}, {1, 0}, {1, 0}, {1, 0}, {1, 0}, {1, 0},
+                {2, 7}, {2, 7}, {2, 7}, {2, 7}, {3, 9}, {3, 9}, {4, 12}, {4, 64}};
+
+        void encode(const series_view &v, std::string &out) {
+            bit_writer w{out};
+            if (v.num > 0) {
+                // time
+                w.put64(static_cast<uint64_t>(v.t(0)));
+                int64_t prevDelta = 0;
+                for (size_t i = 1; i < v.num; ++i) {
+                    auto delta = v.t(i) - v.t(i - 1);
+                    auto z = zigzag(delta - prevDelta);
+                    prevDelta = delta;
+                    if (z == 0) w.put(0, 1);
+                    else if (z < (1u << 7u)) w.put(0b10, 2), w.put(z, 7);
+                    else if (z < (1u << 9u)) w.put(0b110, 3), w.put(z, 9);
+                    else if (z < (1u << 12u)) w.put(0b1110, 4), w.put(z, 12);
+                    else w.put(0b1111, 4), w.put64(z);
+                }
+
+                // values, column by column
+                for (size_t c = 0; c < v.stride(); ++c) {
+                    auto col = v.column(c);
+                    uint32_t prev;
+                    std::memcpy(&prev, &col[0], 4);
+                    w.put(prev, 32);
+                    unsigned prevLead = 33, prevTrail = 0; // no window yet
+                    for (size_t i = 1; i < v.num; ++i) {
+                        uint32_t cur;
+                        std::memcpy(&cur, &col[i], 4);
+                        auto x = cur ^ prev;
+                        prev = cur;
+                        if (x == 0) {
+                            w.put(0, 1);
+                            continue;
+                        }
+                        auto lead = clz32(x), trail = scan::ctz(x);
+                        if (prevLead <= 32 && lead >= prevLead && trail >= prevTrail) {
+                            w.put(0b10, 2);
+                            w.put(x >> prevTrail, 32 - prevLead - prevTrail);
+                        } else {
+                            auto len = 32 - lead - trail;
+                            w.put(0b11, 2);
+                            w.put(lead, 5);
+                            w.put(len - 1, 5);
+                            w.put(x >> trail, len);
+                            prevLead = lead, prevTrail = trail;
+                        }
+                    }
+                }
+            }
+            w.finish();
+        }
+
+        void decode(const char *p, size_t len, size_t num, size_t stride, int64_t *time, float *data, bool columnar) {
+            if (num == 0) return;
+            if (len < Padding) throw std::runtime_error("gorilla: truncated stream");
+            // checked once per value, a value is at most 68 bits
+            const size_t limit = (len - Padding) * 8;
+            auto truncated = []() { throw std::runtime_error("gorilla: truncated stream"); };
+
+            bit_reader r{p};
+            if (limit < 64) truncated();
+            int64_t t = static_cast<int64_t>(r.read64()), delta = 0;
+            time[0] = t;
+            for (size_t i = 1; i < num; ++i) {
+                if (r.pos > limit) truncated();
+                auto b = dodBuckets[r.peek(4)];
+                r.pos += b.prefixLen;
+                uint64_t z = 0;
+                if (b.valueBits == 64) z = r.read64();
+                else if (b.valueBits) z = r.read(b.valueBits);
+                delta += unzigzag(z);
+                t += delta;
+                time[i] = t;
+            }
+
+            size_t colPitch = columnar ? num : 1, rowPitch = columnar ? 1 : stride;
+            for (size_t c = 0; c < stride; ++c) {
+                float *out = data + c * colPitch;
+                if (r.pos > limit) truncated();
+                auto prev = static_cast<uint32_t>(r.read(32));
+                std::memcpy(out, &prev, 4);
+                unsigned lead = 0, trail = 0;
+                for (size_t i = 1; i < num; ++i) {
+                    if (r.pos > limit) truncated();
+                    auto ctl = r.peek(2);
+                    if (ctl < 2) { // 0: same as previous
+                        r.pos += 1;
+                    } else {
+                        r.pos += 2;
+                        if (ctl == 3) { // 11: new window
+                            lead = static_cast<unsigned>(r.read(5));
+                            auto n = static_cast<unsigned>(r.read(5)) + 1;
+                            if (lead + n > 32) throw std::runtime_error("gorilla: invalid stream");
+                            trail = 32 - lead - n;
+                        }
+                        prev ^= static_cast<uint32_t>(r.read(32 - lead - trail)) << trail;
+                    }
+                    std::memcpy(out + i * rowPitch, &prev, 4);
+                }
+            }
+            if (r.pos > limit) truncated();
+        }
+    }
+}
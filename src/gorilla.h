@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace influxdb {
+    struct series_view; // gorilla.h is included by series.cpp, series.h has no include guard
+
+    /**
+     * Gorilla compression (Pelkonen et al., VLDB 2015) of a series: delta-of-delta encoded time followed by each
+     * value column XOR-encoded against its previous value, in one MSB-first bit stream. Regularly sampled time
+     * costs 1 bit per row, a repeated value 1 bit per cell.
+     */
+    namespace gorilla {
+
+        /**
+         * Appends the encoding of the rows of `v` to `out`. The stream ends with padding for the decoder.
+         */
+        void encode(const series_view &v, std::string &out);
+
+        /**
+         * Decodes `num` rows of `stride` values from an encode()d stream into time[num] and data[num * stride]
+         * (column-major if `columnar`). Throws if the stream is truncated.
+         */
+        void decode(const char *p, size_t len, size_t num, size_t stride, int64_t *time, float *data, bool columnar);
+    }
+}
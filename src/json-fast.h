@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "json-readers.h"
+#include "json-stream.h"
+#include "scan.h"
+
+namespace influxdb {
+
+    /**
+     * Fast path for the regular shape of a single series /query response:
+     * {"results":[{"statement_id":0,"series":[{"name":..,"columns":[..],"values":[[t,v,..],..]}]}]}
+     *
+     * Everything up to `"values":[` is buffered, then rows are located with a SIMD scan for the closing bracket and
+     * their numbers are parsed straight into series::time/series::data, without going through rapidjson handlers.
+     * Responses that do not fit (no values, escaped column names, unexpected structure in the head) are handed to
+     * FetchReader instead. So is the rest of the document from a row outside the fast grammar on (whitespace within
+     * the row, strings, bools), the rows before it are kept. Like FetchReader, parsing stops after the first values
+     * array.
+     */
+    class FastFetchReader {
+        enum class State {
+            Head, Values, Done, Fallback
+        };
+
+        client::fetchResult &result;
+        State st = State::Head;
+        std::string buf{}; // head, later the partial row at the end of the last chunk
+        std::string head{}; // up to and including `"values":[`, for a fallback within the values
+        size_t stride = 0;
+        bool afterRow = false;
+        bool miss = false; // scanRows() stopped at a row outside the fast grammar
+
+        FetchReader fallbackReader;
+        std::unique_ptr<json_stream<FetchReader>> fallbackStream{};
+
+        static constexpr size_t MaxHeadLen = 1u << 20u;
+
+        void parseRow(const char *p, const char *end) {
+            if (p == end || !scan::isDigit(*p)) throw std::runtime_error("FastFetchReader: unexpected time");
+            uint64_t t = 0;
+            for (; p < end && scan::isDigit(*p); ++p) t = t * 10 + static_cast<unsigned>(*p - '0');
+            result.time.push_back(static_cast<int64_t>(t));
+
+            auto &data(result.data);
+            size_t col = 0;
+            while (p < end) {
+                if (*p != ',') throw std::runtime_error("FastFetchReader: unexpected char in row");
+                ++p;
+                if (p < end && *p == 'n') {
+                    if (end - p < 4 || std::memcmp(p, "null", 4) != 0)
+                        throw std::runtime_error("FastFetchReader: unexpected value");
+                    data.push_back(data.size() < stride ? NAN : data[data.size() - stride]); // repeat previous
+                    p += 4;
+                } else {
+                    double d;
+                    p = scan::parseNumber(p, end, d);
+                    data.push_back(static_cast<float>(d));
+                }
+                ++col;
+            }
+            if (col != stride) throw std::runtime_error("FastFetchReader: unexpected row length");
+        }
+
+        /**
+         * Scans complete rows in [p, end), returns the position of the first unconsumed byte. Sets `miss` and
+         * returns the start of the row if a row is outside the fast grammar.
+         */
+        const char *scanRows(const char *p, const char *end) {
+            while (p < end) {
+                char c = *p;
+                if (c == ']') {
+                    st = State::Done;
+                    return end;
+                }
+                if (c == ',' && afterRow) {
+                    afterRow = false;
+                    ++p;
+                    continue;
+                }
+                if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+                    ++p;
+                    continue;
+                }
+                if (afterRow) throw std::runtime_error("FastFetchReader: unexpected char in values");
+                if (c != '[') {
+                    miss = true;
+                    return p;
+                }
+                auto rowEnd = scan::findByte(p, end, ']');
+                if (!rowEnd) break;
+                auto numTime = result.time.size(), numData = result.data.size();
+                try {
+                    parseRow(p + 1, rowEnd);
+                } catch (const std::runtime_error &) {
+                    result.time.resize(numTime);
+                    result.data.resize(numData);
+                    miss = true;
+                    return p;
+                }
+                p = rowEnd + 1;
+                afterRow = true;
+            }
+            return p;
+        }
+
+        /**
+         * Reads the column names from the buffered head, returns false if they are not plain strings.
+         */
+        bool parseColumns(size_t valuesPos) {
+            static const char colKey[] = "\"columns\":[";
+            auto c = buf.find(colKey);
+            if (c == std::string::npos || c > valuesPos) return false;
+            const char *p = buf.data() + c + sizeof(colKey) - 1, *end = buf.data() + valuesPos;
+            result.columns.clear();
+            while (p < end && *p == '"') {
+                auto q = static_cast<const char *>(std::memchr(p + 1, '"', static_cast<size_t>(end - p - 1)));
+                if (!q) return false;
+                if (std::memchr(p + 1, '\\', static_cast<size_t>(q - p - 1))) return false;
+                result.columns.emplace_back(p + 1, q);
+                p = q + 1;
+                if (p < end && *p == ',') ++p;
+                else break;
+            }
+            return p < end && *p == ']' && result.columns.size() >= 2;
+        }
+
+        void fallback() {
+            st = State::Fallback; // nothing of this document is in result yet
+            result.columns.clear();
+            fallbackStream = std::make_unique<json_stream<FetchReader>>(fallbackReader);
+            fallbackStream->feed(buf.data(), buf.size());
+            buf.clear();
+            buf.shrink_to_fit();
+        }
+
+        /**
+         * Hands the document from the row at `p` on to FetchReader, which reads the head again and appends the rows.
+         */
+        void fallbackAt(const char *p, const char *end) {
+            st = State::Fallback;
+            fallbackStream = std::make_unique<json_stream<FetchReader>>(fallbackReader);
+            fallbackStream->feed(head.data(), head.size());
+            fallbackStream->feed(p, static_cast<size_t>(end - p));
+            head.clear();
+            head.shrink_to_fit();
+        }
+
+        void feedHead(const char *chunk, size_t len) {
+            static const char valuesKey[] = "\"values\":[";
+            constexpr size_t keyLen = sizeof(valuesKey) - 1;
+            auto searchFrom = buf.size() >= keyLen ? buf.size() - keyLen : 0;
+            buf.append(chunk, len);
+            auto v = buf.find(valuesKey, searchFrom);
+            if (v == std::string::npos) {
+                if (buf.size() > MaxHeadLen) fallback();
+                return;
+            }
+            if (!parseColumns(v)) {
+                fallback();
+                return;
+            }
+            stride = result.columns.size() - 1;
+            st = State::Values;
+            head.assign(buf, 0, v + keyLen);
+            std::string rows = buf.substr(v + keyLen);
+            buf.clear();
+            feedValues(rows.data(), rows.size());
+        }
+
+        void feedValues(const char *p, size_t len) {
+            const char *end = p + len;
+            if (!buf.empty()) {
+                // complete the partial row of the previous chunk
+                auto rowEnd = scan::findByte(p, end, ']');
+                auto n = rowEnd ? static_cast<size_t>(rowEnd + 1 - p) : len;
+                buf.append(p, n);
+                p += n;
+                auto rest = scanRows(buf.data(), buf.data() + buf.size());
+                if (miss) {
+                    fallbackAt(rest, buf.data() + buf.size());
+                    buf.clear();
+                    fallbackStream->feed(p, static_cast<size_t>(end - p));
+                    return;
+                }
+                buf.erase(0, static_cast<size_t>(rest - buf.data()));
+                if (!buf.empty() || st != State::Values) return;
+            }
+            auto rest = scanRows(p, end);
+            if (miss) fallbackAt(rest, end);
+            else if (st == State::Values) buf.assign(rest, end);
+        }
+
+    public:
+        explicit FastFetchReader(client::fetchResult &res) : result(res), fallbackReader(res) {}
+
+        void feed(const char *chunk, size_t len) {
+            switch (st) {
+                case State::Head:
+                    feedHead(chunk, len);
+                    break;
+                case State::Values:
+                    feedValues(chunk, len);
+                    break;
+                case State::Fallback:
+                    fallbackStream->feed(chunk, len);
+                    break;
+                case State::Done:
+                    break;
+            }
+        }
+
+        void finish() {
+            if (st == State::Head) fallback(); // no values, e.g. an empty or error response
+            if (st == State::Fallback) {
+                fallbackStream->finish();
+                return;
+            }
+            if (st != State::Done) throw std::runtime_error("FastFetchReader: truncated response");
+        }
+
+        bool usedFallback() const { return st == State::Fallback; }
+    };
+}
@@ -3,6 +3,7 @@
 #include <cmath>
 #include "rapidjson/reader.h"
 #include "client.h"
+#include "tag-dict.h"
 
 namespace influxdb {
     using namespace rapidjson;
@@ -179,20 +180,139 @@ namespace influxdb {
     };
 
 
+    /**
+     * Reads columns and values of a single series response in one pass (columns precede values in the response).
+     */
+    struct FetchReader {
+        client::fetchResult &result;
+        bool inColArray = false;
+        int inDataArray = 0;
+        size_t colIndex = 0;
+        size_t stride = 0;
+
+        explicit FetchReader(client::fetchResult &res) : result(res) {}
+
+        bool Key(const char *str, SizeType length, bool copy) {
+            if (length == 7 && strncmp(str, "columns", length) == 0) {
+                inColArray = true;
+                result.columns.clear();
+            } else if (length == 6 && strncmp(str, "values", length) == 0) {
+                if (result.columns.size() < 2) throw std::runtime_error("FetchReader: values before columns");
+                stride = result.columns.size() - 1;
+                ++inDataArray;
+            }
+            return true;
+        }
+
+        bool StartArray() {
+            if (inDataArray)
+                ++inDataArray;
+            return true;
+        }
+
+        bool EndArray(SizeType elementCount) {
+            if (inColArray) {
+                inColArray = false;
+            } else if (inDataArray) {
+                --inDataArray;
+                if (inDataArray == 0) return false;
+                else if (inDataArray == 2) {
+                    if (colIndex != stride + 1) throw std::runtime_error("FetchReader: unexpected row length");
+                    colIndex = 0;
+                }
+            }
+            return true;
+        }
+
+        bool Uint64(uint64_t u) {
+            if (inDataArray == 3) {
+                if (colIndex == 0) result.time.push_back(u);
+                else result.data.push_back(u);
+                ++colIndex;
+            }
+            return true;
+        }
+
+        bool Double(double d) {
+            if (inDataArray == 3) {
+                if (colIndex > 0) result.data.push_back(static_cast<float>(d));
+                else throw std::runtime_error("unexpected double");
+                ++colIndex;
+            }
+            return true;
+        }
+
+        bool Uint(unsigned u) {
+            if (inDataArray == 3) {
+                if (colIndex > 0) result.data.push_back(u);
+                else throw std::runtime_error("unexpected uint");
+                ++colIndex;
+            }
+            return true;
+        }
+
+        bool Null() {
+            if (inDataArray == 3) {
+                if (colIndex > 0) {
+                    auto &d{result.data};
+                    d.push_back((d.size() < stride) ? NAN : d[d.size() - stride]); // repeat previous
+                } else throw std::runtime_error("unexpected null");
+                ++colIndex;
+            }
+            return true;
+        }
+
+        bool String(const char *str, SizeType length, bool copy) {
+            if (inColArray) result.columns.emplace_back(str, length);
+            else if (inDataArray) throw std::runtime_error("unexpected string");
+            return true;
+        }
+
+        bool Bool(bool b) {
+            if (inDataArray) throw std::runtime_error("unexpected bool");
+            return true;
+        }
+
+        bool Int(int i) {
+            if (inDataArray) throw std::runtime_error("unexpected int");
+            return true;
+        }
+
+        bool Int64(int64_t i) {
+            if (inDataArray) throw std::runtime_error("unexpected int64");
+            return true;
+        }
+
+        bool RawNumber(const char *str, SizeType length, bool copy) {
+            if (inDataArray) throw std::runtime_error("unexpected raw number");
+            return true;
+        }
+
+        bool StartObject() {
+            if (inDataArray) throw std::runtime_error("FetchReader: unexpected object");
+            return true;
+        }
+
+        bool EndObject(SizeType memberCount) { return true; }
+    };
+
+
     struct SeriesReader {
         static constexpr int SeriesObjectLevel = 2;
         static constexpr int SeriesArrayLevelSeries = 2;
         static constexpr int SeriesArrayLevelRow = 3;
         static constexpr int SeriesArrayLevelCol = 4;
 
-        const size_t numColumns;
+        size_t numColumns = 0; // of the current series
 
         std::vector<series> &series_;
         series *currentSeries = nullptr;
+        tag_dict *dict; // if set, tags are interned into series::tagIds
 
         int inSeriesArray = 0;
         int lvObjects = -1;
         bool inTags = false;
+        bool inColumns = false;
         std::string currentTagKey;
 
         int colIndex = 0;
@@ -200,19 +320,29 @@ namespace influxdb {
         uint64_t rowTime; //unused!
 
 
-        SeriesReader(size_t numColumns, std::vector<series> &res) : numColumns(numColumns), series_(res) {}
+        /**
+         * Reads the columns and values of every series in one pass, the columns are set on each series.
+         */
+        explicit SeriesReader(std::vector<series> &res, tag_dict *dict = nullptr) : series_(res), dict(dict) {}
 
 
         bool Key(const char *str, SizeType length, bool copy) {
 
             if (inTags) {
-                currentTagKey = std::string(str, length);
+                if (dict) currentSeries->tagIds.push_back(dict->intern(str, length));
+                else currentTagKey = std::string(str, length);
             }
 
             if (inSeriesArray && !inTags && strncmp(str, "tags", length) == 0) {
                 inTags = true;
             }
 
+            if (inSeriesArray && !inTags && length == 7 && strncmp(str, "columns", length) == 0) {
+                if (!currentSeries) throw std::runtime_error("SeriesReader: columns outside of a series");
+                inColumns = true;
+                currentSeries->columns.clear();
+            }
+
             if (strncmp(str, "series", length) == 0)
                 ++inSeriesArray;
 
@@ -227,6 +357,11 @@ namespace influxdb {
         }
 
         bool EndArray(SizeType elementCount) {
+            if (inColumns) {
+                inColumns = false;
+                numColumns = currentSeries->columns.size();
+                if (numColumns < 2) throw std::runtime_error("SeriesReader: expected time and value columns");
+            }
             if (inSeriesArray) {
                 --inSeriesArray;
                 if (inSeriesArray == 0) return false;
@@ -244,6 +379,7 @@ namespace influxdb {
             if (inSeriesArray == SeriesArrayLevelSeries && !currentSeries && lvObjects == SeriesObjectLevel) {
                 series_.resize(series_.size() + 1);
                 currentSeries = &series_.back();
+                numColumns = 0;
             }
 
             if (inSeriesArray >= SeriesArrayLevelRow) {
@@ -259,6 +395,7 @@ namespace influxdb {
 
             if (inTags) {
                 inTags = false;
+                if (dict) tag_dict::normalize(currentSeries->tagIds);
             }
 
             --lvObjects;
@@ -267,6 +404,7 @@ namespace influxdb {
 
         bool Uint64(uint64_t u) {
             if (inSeriesArray == SeriesArrayLevelCol) {
+                if (numColumns == 0) throw std::runtime_error("SeriesReader: values before columns");
                 if (colIndex == 0) currentSeries->time.push_back(u);
                 else currentSeries->data.push_back(u);
                 ++colIndex;
@@ -310,9 +448,14 @@ namespace influxdb {
             if (inSeriesArray >= SeriesArrayLevelCol) {
                 throw std::runtime_error("SeriesReader: unexpected string " + std::string(str));
             }
+            if (inColumns) {
+                currentSeries->columns.emplace_back(str, length);
+                return true;
+            }
             if (inTags) {
                 //LOG_D << "tag " << currentTagKey << "=" << std::string(str);
-                currentSeries->tags.emplace(std::move(currentTagKey), std::string{str, length});
+                if (dict) currentSeries->tagIds.push_back(dict->intern(str, length));
+                else currentSeries->tags.emplace(std::move(currentTagKey), std::string{str, length});
             }
             return true;
         }
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "rapidjson/reader.h"
+
+namespace influxdb {
+
+    /**
+     * Push-style incremental JSON parser. Chunks of a document are fed as they arrive and every complete token is
+     * passed to the rapidjson handler right away (rapidjson iterative parser). Only the unparsed tail of the input
+     * (at most one chunk plus a partial token) is buffered.
+     * A handler returning false ends parsing early, remaining input is ignored.
+     */
+    template<class Handler>
+    class json_stream {
+        struct buffer_stream {
+            typedef char Ch;
+
+            std::vector<char> &buf;
+            size_t pos;
+            size_t base; // number of bytes dropped from the front of buf
+
+            Ch Peek() const { return pos < buf.size() ? buf[pos] : '\0'; }
+
+            Ch Take() { return pos < buf.size() ? buf[pos++] : '\0'; }
+
+            size_t Tell() const { return base + pos; }
+
+            Ch *PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+
+            void Put(Ch) { RAPIDJSON_ASSERT(false); }
+
+            void Flush() { RAPIDJSON_ASSERT(false); }
+
+            size_t PutEnd(Ch *) { RAPIDJSON_ASSERT(false); return 0; }
+        };
+
+        static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+        /**
+         * True if [p, end) starts with a complete token (optionally preceded by a , or : delimiter), so rapidjson
+         * will not hit the end of the buffer in the middle of it.
+         */
+        static bool haveToken(const char *p, const char *end) {
+            while (p < end && isSpace(*p)) ++p;
+            if (p < end && (*p == ',' || *p == ':')) {
+                ++p;
+                while (p < end && isSpace(*p)) ++p;
+            }
+            if (p == end) return false;
+            switch (*p) {
+                case '{':
+                case '}':
+                case '[':
+                case ']':
+                    return true;
+                case '"':
+                    for (++p; p < end; ++p) {
+                        if (*p == '\\') ++p;
+                        else if (*p == '"') return true;
+                    }
+                    return false;
+                case 't':
+                case 'n':
+                    return end - p >= 4;
+                case 'f':
+                    return end - p >= 5;
+                default: // number, needs a terminating char
+                    while (p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.' ||
+                                       *p == 'e' || *p == 'E'))
+                        ++p;
+                    return p < end;
+            }
+        }
+
+        Handler &handler;
+        rapidjson::Reader reader;
+        std::vector<char> buf;
+        buffer_stream is{buf, 0, 0};
+        bool done = false;
+
+        void parse(bool final) {
+            while (!done && (final || haveToken(buf.data() + is.pos, buf.data() + buf.size()))) {
+                reader.IterativeParseNext<rapidjson::kParseDefaultFlags>(is, handler);
+                if (reader.HasParseError() || reader.IterativeParseComplete()) done = true;
+            }
+        }
+
+    public:
+        explicit json_stream(Handler &handler) : handler(handler) {
+            reader.IterativeParseInit();
+        }
+
+        void feed(const char *chunk, size_t len) {
+            if (done) return;
+            if (is.pos > 0) {
+                // drop parsed input
+                buf.erase(buf.begin(), buf.begin() + is.pos);
+                is.base += is.pos;
+                is.pos = 0;
+            }
+            buf.insert(buf.end(), chunk, chunk + len);
+            parse(false);
+        }
+
+        /**
+         * Parse what is left after the last chunk. Throws on malformed or truncated input.
+         */
+        void finish() {
+            parse(true);
+            buf.clear();
+            buf.shrink_to_fit();
+            if (reader.HasParseError() && reader.GetParseErrorCode() != rapidjson::kParseErrorTermination) {
+                throw std::runtime_error("response parse error " + std::to_string(reader.GetParseErrorCode()) +
+                                         " at offset " + std::to_string(reader.GetErrorOffset()));
+            }
+        }
+
+        /** true once the document (or the handler) is done */
+        bool complete() const { return done; }
+
+        /** bytes consumed so far */
+        size_t offset() const { return is.Tell(); }
+    };
+}
@@ -0,0 +1,137 @@
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "gorilla.h"
+#include "mapped-series.h"
+
+namespace influxdb {
+
+    mapped_file::mapped_file(const std::string &path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            file = nullptr;
+            throw std::runtime_error("cant open " + path);
+        }
+        LARGE_INTEGER size;
+        GetFileSizeEx(file, &size);
+        len = static_cast<size_t>(size.QuadPart);
+        if (len > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            addr = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cant open " + path);
+        struct stat st{};
+        if (fstat(fd, &st) == 0) len = static_cast<size_t>(st.st_size);
+        if (len > 0) {
+            addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) addr = nullptr;
+        }
+        ::close(fd);
+#endif
+        if (len > 0 && !addr) {
+            unmap();
+            throw std::runtime_error("cant map " + path);
+        }
+    }
+
+    void mapped_file::unmap() {
+#ifdef _WIN32
+        if (addr) UnmapViewOfFile(addr);
+        if (mapping) CloseHandle(mapping);
+        if (file) CloseHandle(file);
+        mapping = file = nullptr;
+#else
+        if (addr) munmap(addr, len);
+#endif
+        addr = nullptr;
+    }
+
+    mapped_file::~mapped_file() {
+        unmap();
+    }
+
+    mapped_series::mapped_series(const std::string &path, bool verify) : mapped_series(path, 0, verify) {
+    }
+
+    mapped_series::mapped_series(const std::string &path, size_t offset, bool verify)
+            : file(std::make_unique<mapped_file>(path)) {
+        if (offset > file->size() || offset % series_file_header::Align)
+            throw std::runtime_error("invalid series file offset " + path);
+        const auto *p = file->data() + offset;
+        auto len = file->size() - offset;
+        series_file_header h{};
+        if (len < sizeof(h)) throw std::runtime_error("invalid series file " + path);
+        std::memcpy(&h, p, sizeof(h));
+        if (std::memcmp(h.magic, series_file_header::magicString(), sizeof(h.magic)) != 0
+            || h.version != series_file_header::Version || h.metaLen > len || h.dataStride > (1u << 20u)
+            || h.num > len)
+            throw std::runtime_error("invalid series file " + path);
+        series::parseFileMeta(p + sizeof(h), h.metaLen, meta);
+
+        if (h.flags & series_file_header::Gorilla) {
+            // decoded into memory, only the metadata and the stream are read in place
+            uint64_t encLen = 0;
+            if (h.timeOffset() + sizeof(encLen) > len) throw std::runtime_error("invalid series file " + path);
+            std::memcpy(&encLen, p + h.timeOffset(), sizeof(encLen));
+            const char *enc = p + h.timeOffset() + sizeof(encLen);
+            // every cell takes at least one bit
+            if (encLen > len - h.timeOffset() - sizeof(encLen) || h.num * (h.dataStride + 1) > encLen * 8 + 64)
+                throw std::runtime_error("invalid series file " + path);
+            if (verify && seriesChecksum(seriesChecksum(0, p + sizeof(h), h.metaLen), enc, encLen) != h.checksum)
+                throw std::runtime_error("series file checksum mismatch: " + path);
+            meta.num = h.num;
+            meta.dataStride = h.dataStride;
+            meta.columnar = (h.flags & series_file_header::Columnar) != 0;
+            meta.time.resize(meta.num);
+            meta.data.resize(meta.num * meta.dataStride);
+            gorilla::decode(enc, encLen, meta.num, meta.dataStride, meta.time.data(), meta.data.data(),
+                            meta.columnar);
+            if (h.flags & series_file_header::CompactTime) meta.compactTime();
+            v = meta;
+            file.reset();
+            return;
+        }
+
+        if (h.size() > len || ((h.flags & series_file_header::CompactTime) && h.tInterval == 0))
+            throw std::runtime_error("invalid series file " + path);
+        bool compact = (h.flags & series_file_header::CompactTime) != 0;
+        if (compact) meta.tStart = h.tStart, meta.tInterval = h.tInterval;
+        meta.dataStride = h.dataStride;
+
+        v.src = &meta;
+        v.time = compact ? nullptr : reinterpret_cast<const int64_t *>(p + h.timeOffset());
+        v.data = reinterpret_cast<const float *>(p + h.dataOffset());
+        v.rowsTotal = v.num = h.num;
+        v.dataStride = h.dataStride;
+        v.columnar = (h.flags & series_file_header::Columnar) != 0;
+
+        if (verify) {
+            auto timeBytes = compact ? 0 : h.num * sizeof(int64_t);
+            auto sum = seriesChecksum(seriesChecksum(seriesChecksum(0, p + sizeof(h), h.metaLen),
+                                                     p + h.timeOffset(), timeBytes),
+                                      p + h.dataOffset(), h.num * h.dataStride * sizeof(float));
+            if (sum != h.checksum) throw std::runtime_error("series file checksum mismatch: " + path);
+        }
+    }
+
+    series mapped_series::release() {
+        // a decoded file already is a series of its own
+        series s = file ? v.toSeries() : std::move(meta);
+        v = series_view{};
+        file.reset();
+        return s;
+    }
+}
\ No newline at end of file
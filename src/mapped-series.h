@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "client.h"
+
+namespace influxdb {
+
+    /**
+     * A file mapped read-only into memory, empty files have no mapping (data() is nullptr). Throws if the file cannot
+     * be opened or mapped.
+     */
+    class mapped_file {
+        void *addr = nullptr;
+        size_t len = 0;
+#ifdef _WIN32
+        void *file = nullptr, *mapping = nullptr;
+#endif
+
+        void unmap();
+
+    public:
+        explicit mapped_file(const std::string &path);
+
+        mapped_file(const mapped_file &) = delete;
+
+        mapped_file &operator=(const mapped_file &) = delete;
+
+        ~mapped_file();
+
+        const char *data() const { return static_cast<const char *>(addr); }
+
+        size_t size() const { return len; }
+    };
+
+    /**
+     * A series file (binary format of operator<<, see series_file_header) mapped read-only into memory. view()
+     * reads time and data in place, opening a file costs no deserialization beyond the metadata (and, if verified,
+     * one pass of the checksum over the mapping). Gorilla compressed files are decoded into memory instead.
+     */
+    class mapped_series {
+        std::unique_ptr<mapped_file> file;
+        series meta{}; // name, tags, columns and compact time of the view, all of it if compressed
+        series_view v{};
+
+    public:
+        /**
+         * Throws if the file cannot be mapped or is not a valid series file.
+         */
+        explicit mapped_series(const std::string &path, bool verify = true);
+
+        /**
+         * The series stored at `offset` (a multiple of series_file_header::Align) of a larger file.
+         */
+        mapped_series(const std::string &path, size_t offset, bool verify = true);
+
+        mapped_series(const mapped_series &) = delete;
+
+        mapped_series &operator=(const mapped_series &) = delete;
+
+        const series_view &view() const { return v; }
+
+        /**
+         * Whether view() reads the file in place, false if it was decoded into memory.
+         */
+        bool inPlace() const { return file != nullptr; }
+
+        /**
+         * The series, leaving this empty (view() then has no rows). A decoded file is moved out, a mapped one copied.
+         */
+        series release();
+    };
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "rapidjson/reader.h"
+
+namespace influxdb {
+
+    /**
+     * Push-style MessagePack decoder that drives a rapidjson-style SAX handler (FetchReader, SeriesReader, ...), so
+     * a msgpack response (Accept: application/x-msgpack) fills a series exactly like its JSON counterpart.
+     * Integers are reported like rapidjson does (Uint/Uint64 for non-negative, Int/Int64 for negative values), floats
+     * as Double, map keys with Key(). Strings point into the receive buffer (copy=false, not null-terminated).
+     * Timestamp extensions (influxdb's msgp time, type 5, and the msgpack timestamp, type -1) are reported as epoch ms.
+     * Chunks may be cut anywhere, only the incomplete last token is kept. Several top-level values may follow each
+     * other (chunked responses). A handler returning false ends decoding.
+     */
+    template<class Handler>
+    class msgpack_stream {
+        struct container {
+            bool isMap;
+            uint32_t size;
+            uint64_t remaining; // items left, a map member counts twice (key and value)
+        };
+
+        Handler &handler;
+        std::vector<char> buf;
+        size_t pos = 0;
+        std::vector<container> stack;
+        bool done = false;
+
+        static uint64_t be(const unsigned char *p, int n) {
+            uint64_t v = 0;
+            for (int i = 0; i < n; ++i) v = (v << 8u) | p[i];
+            return v;
+        }
+
+        bool isKey() const {
+            return !stack.empty() && stack.back().isMap && stack.back().remaining % 2 == 0;
+        }
+
+        bool uint(uint64_t u) {
+            if (u <= std::numeric_limits<unsigned>::max()) return handler.Uint(static_cast<unsigned>(u));
+            return handler.Uint64(u);
+        }
+
+        bool sint(int64_t i) {
+            if (i >= 0) return uint(static_cast<uint64_t>(i));
+            if (i >= std::numeric_limits<int>::min()) return handler.Int(static_cast<int>(i));
+            return handler.Int64(i);
+        }
+
+        bool str(const char *s, size_t len) {
+            if (isKey()) return handler.Key(s, static_cast<rapidjson::SizeType>(len), false);
+            return handler.String(s, static_cast<rapidjson::SizeType>(len), false);
+        }
+
+        static int64_t timestampMs(int8_t type, const unsigned char *p, size_t len) {
+            // msgp (influxdb's encoder): 8 bytes seconds, then 4 bytes nanoseconds
+            if (type == 5) {
+                if (len != 12) throw std::runtime_error("msgpack: invalid time extension");
+                return static_cast<int64_t>(be(p, 8)) * 1000 + static_cast<int64_t>(be(p + 8, 4)) / 1000000;
+            }
+            if (type != -1) throw std::runtime_error("msgpack: unexpected ext type " + std::to_string(type));
+            if (len == 4) return static_cast<int64_t>(be(p, 4)) * 1000;
+            if (len == 8) {
+                auto v = be(p, 8);
+                return static_cast<int64_t>(v & 0x3ffffffffull) * 1000 + static_cast<int64_t>(v >> 34u) / 1000000;
+            }
+            if (len == 12)
+                return static_cast<int64_t>(be(p + 4, 8)) * 1000 + static_cast<int64_t>(be(p, 4)) / 1000000;
+            throw std::runtime_error("msgpack: invalid timestamp");
+        }
+
+        /**
+         * An item of the current container was read, close the containers that are complete now.
+         */
+        bool itemDone() {
+            while (!stack.empty()) {
+                auto &c(stack.back());
+                if (--c.remaining > 0) return true;
+                auto n = c.size;
+                bool isMap = c.isMap;
+                stack.pop_back();
+                if (!(isMap ? handler.EndObject(n) : handler.EndArray(n))) return false;
+            }
+            return true;
+        }
+
+        bool open(bool isMap, uint32_t n) {
+            if (isKey()) throw std::runtime_error("msgpack: container as map key");
+            if (!(isMap ? handler.StartObject() : handler.StartArray())) return false;
+            if (n == 0) {
+                if (!(isMap ? handler.EndObject(0) : handler.EndArray(0))) return false;
+                return itemDone();
+            }
+            stack.push_back({isMap, n, isMap ? 2ull * n : n});
+            return true;
+        }
+
+        /**
+         * Decodes the token at pos. Returns false (and leaves pos) if it is incomplete.
+         */
+        bool next() {
+            const auto *p = reinterpret_cast<const unsigned char *>(buf.data()) + pos;
+            size_t avail = buf.size() - pos;
+            if (avail == 0) return false;
+            unsigned char b = p[0];
+
+            auto need = [avail](size_t n) { return avail >= n; };
+            bool ok;
+            size_t len;
+
+            if (b <= 0x7f) {
+                ok = uint(b), len = 1;
+            } else if (b >= 0xe0) {
+                ok = sint(static_cast<int8_t>(b)), len = 1;
+            } else if ((b & 0xf0u) == 0x80) {
+                pos += 1;
+                ok = open(true, b & 0x0fu);
+                if (!ok) done = true;
+                return true;
+            } else if ((b & 0xf0u) == 0x90) {
+                pos += 1;
+                ok = open(false, b & 0x0fu);
+                if (!ok) done = true;
+                return true;
+            } else if ((b & 0xe0u) == 0xa0) {
+                len = 1 + (b & 0x1fu);
+                if (!need(len)) return false;
+                ok = str(reinterpret_cast<const char *>(p + 1), len - 1);
+            } else {
+                switch (b) {
+                    case 0xc0:
+                        ok = handler.Null(), len = 1;
+                        break;
+                    case 0xc2:
+                    case 0xc3:
+                        ok = handler.Bool(b == 0xc3), len = 1;
+                        break;
+                    case 0xca: {
+                        if (!need(5)) return false;
+                        auto u = static_cast<uint32_t>(be(p + 1, 4));
+                        float f;
+                        std::memcpy(&f, &u, 4);
+                        ok = handler.Double(f), len = 5;
+                        break;
+                    }
+                    case 0xcb: {
+                        if (!need(9)) return false;
+                        auto u = be(p + 1, 8);
+                        double d;
+                        std::memcpy(&d, &u, 8);
+                        ok = handler.Double(d), len = 9;
+                        break;
+                    }
+                    case 0xcc:
+                    case 0xcd:
+                    case 0xce:
+                    case 0xcf: {
+                        int n = 1 << (b - 0xcc);
+                        if (!need(1 + n)) return false;
+                        ok = uint(be(p + 1, n)), len = 1 + n;
+                        break;
+                    }
+                    case 0xd0:
+                    case 0xd1:
+                    case 0xd2:
+                    case 0xd3: {
+                        int n = 1 << (b - 0xd0);
+                        if (!need(1 + n)) return false;
+                        auto u = be(p + 1, n);
+                        int64_t i = n == 8 ? static_cast<int64_t>(u)
+                                           : static_cast<int64_t>(u << (64u - 8u * n)) >> (64u - 8u * n);
+                        ok = sint(i), len = 1 + n;
+                        break;
+                    }
+                    case 0xd9:
+                    case 0xda:
+                    case 0xdb: {
+                        int n = 1 << (b - 0xd9);
+                        if (!need(1 + n)) return false;
+                        auto sl = static_cast<size_t>(be(p + 1, n));
+                        len = 1 + n + sl;
+                        if (!need(len)) return false;
+                        ok = str(reinterpret_cast<const char *>(p + 1 + n), sl);
+                        break;
+                    }
+                    case 0xdc:
+                    case 0xdd:
+                    case 0xde:
+                    case 0xdf: {
+                        int n = (b & 1u) ? 4 : 2;
+                        if (!need(1 + n)) return false;
+                        pos += 1 + n;
+                        if (!open(b >= 0xde, static_cast<uint32_t>(be(p + 1, n)))) done = true;
+                        return true;
+                    }
+                    case 0xd4:
+                    case 0xd5:
+                    case 0xd6:
+                    case 0xd7:
+                    case 0xd8: {
+                        size_t dl = size_t(1) << (b - 0xd4);
+                        len = 2 + dl;
+                        if (!need(len)) return false;
+                        ok = sint(timestampMs(static_cast<int8_t>(p[1]), p + 2, dl));
+                        break;
+                    }
+                    case 0xc7:
+                    case 0xc8:
+                    case 0xc9: {
+                        int n = 1 << (b - 0xc7);
+                        if (!need(2 + n)) return false;
+                        auto dl = static_cast<size_t>(be(p + 1, n));
+                        len = 2 + n + dl;
+                        if (!need(len)) return false;
+                        ok = sint(timestampMs(static_cast<int8_t>(p[1 + n]), p + 2 + n, dl));
+                        break;
+                    }
+                    default:
+                        throw std::runtime_error("msgpack: unexpected type byte " + std::to_string(b));
+                }
+            }
+
+            pos += len;
+            if (!ok || !itemDone()) done = true;
+            return true;
+        }
+
+    public:
+        explicit msgpack_stream(Handler &handler) : handler(handler) {}
+
+        void feed(const char *chunk, size_t len) {
+            if (done) return;
+            if (pos > 0) {
+                buf.erase(buf.begin(), buf.begin() + pos);
+                pos = 0;
+            }
+            buf.insert(buf.end(), chunk, chunk + len);
+            while (!done && next());
+        }
+
+        /**
+         * Throws if the input ended inside a value.
+         */
+        void finish() {
+            if (!done && (pos != buf.size() || !stack.empty()))
+                throw std::runtime_error("msgpack: truncated response");
+            buf.clear();
+            buf.shrink_to_fit();
+        }
+
+        bool complete() const { return done; }
+    };
+}
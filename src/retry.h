@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+
+
+namespace influxdb {
+
+    using namespace std::chrono_literals;
+
+    constexpr int MaxRetries = 7;
+    constexpr auto RetryBaseDelay = 200ms;
+
+    /**
+     * Exponential backoff with jitter: a random delay in [d/2, d] with d = RetryBaseDelay * 2^retry.
+     */
+    inline std::chrono::milliseconds retryDelay(int retry) {
+        static thread_local std::mt19937 rng{std::random_device{}()};
+        auto d = RetryBaseDelay * (1 << retry);
+        std::uniform_int_distribution<decltype(d.count())> dist(d.count() / 2, d.count());
+        return std::chrono::milliseconds(dist(rng));
+    }
+
+    /**
+     * Number of retries shared by all requests of a single fetch.
+     */
+    class retry_budget {
+        std::atomic<int> remaining;
+    public:
+        explicit retry_budget(int retries) : remaining{retries} {}
+
+        bool take() { return --remaining >= 0; }
+    };
+
+    /**
+     * Opens after `threshold` consecutive transient failures. While open, requests fail fast.
+     * After `cooldown` a single probe request is let through; its outcome closes or re-opens the breaker.
+     */
+    class circuit_breaker {
+        typedef std::chrono::steady_clock clock;
+
+        const int threshold;
+        const std::chrono::milliseconds cooldown;
+
+        std::mutex mtx;
+        int failures{0};
+        clock::time_point openUntil{};
+
+    public:
+        circuit_breaker(int threshold, std::chrono::milliseconds cooldown) : threshold{threshold},
+                                                                             cooldown{cooldown} {}
+
+        bool allow() {
+            std::lock_guard<std::mutex> lk{mtx};
+            if (failures < threshold) return true;
+            auto now = clock::now();
+            if (now < openUntil) return false;
+            openUntil = now + cooldown; // half-open, probe
+            return true;
+        }
+
+        void success() {
+            std::lock_guard<std::mutex> lk{mtx};
+            failures = 0;
+        }
+
+        void failure() {
+            std::lock_guard<std::mutex> lk{mtx};
+            if (++failures >= threshold) openUntil = clock::now() + cooldown;
+        }
+
+        bool isOpen() {
+            std::lock_guard<std::mutex> lk{mtx};
+            return failures >= threshold && clock::now() < openUntil;
+        }
+    };
+}
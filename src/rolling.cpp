@@ -0,0 +1,136 @@
+#include <cmath>
+#include <stdexcept>
+
+#include "rolling.h"
+
+namespace influxdb {
+
+    rolling_window::rolling_window(window_fn fn, window_size size, size_t columns)
+            : fn(fn), size(size), stride(columns) {
+        if (size.duration <= 0 && size.rows == 0) throw std::runtime_error("rolling window must not be empty");
+        reset();
+    }
+
+    void rolling_window::reset() {
+        wTime.clear();
+        wData.clear();
+        head = 0;
+        dropped = 0;
+        consumed = 0;
+        bool sums = fn == window_fn::sum || fn == window_fn::mean || fn == window_fn::stddev;
+        sum.assign(sums ? stride : 0, 0.);
+        sumSq.assign(fn == window_fn::stddev ? stride : 0, 0.);
+        cnt.assign(stride, 0.f);
+        extremes.assign(sums ? 0 : stride, {});
+    }
+
+    void rolling_window::evict() {
+        auto n = wTime.size();
+        auto now = wTime.back();
+        while (head < n && (size.rows ? n - head > size.rows : wTime[head] <= now - size.duration)) {
+            const float *row = &wData[head * stride];
+            uint64_t seq = dropped + head;
+            for (size_t c = 0; c < stride; ++c) cnt[c] -= row[c] == row[c] ? 1.f : 0.f;
+            if (!sum.empty()) {
+                for (size_t c = 0; c < stride; ++c) sum[c] -= row[c] == row[c] ? row[c] : 0.;
+                if (!sumSq.empty())
+                    for (size_t c = 0; c < stride; ++c) sumSq[c] -= row[c] == row[c] ? double(row[c]) * row[c] : 0.;
+            } else {
+                for (auto &dq : extremes) if (!dq.empty() && dq.front() == seq) dq.pop_front();
+            }
+            ++head;
+        }
+
+        // drop evicted rows from the buffer once they are the larger part of it
+        if (head >= 64 && head * 2 >= n) {
+            wTime.erase(wTime.begin(), wTime.begin() + head);
+            wData.erase(wData.begin(), wData.begin() + head * stride);
+            dropped += head;
+            head = 0;
+        }
+    }
+
+    void rolling_window::push(int64_t t, const float *row, float *out) {
+        if (!wTime.empty() && t < wTime.back()) throw std::runtime_error("rolling window: time jump backwards");
+        uint64_t seq = dropped + wTime.size();
+        wTime.push_back(t);
+        wData.insert(wData.end(), row, row + stride);
+
+        for (size_t c = 0; c < stride; ++c) cnt[c] += row[c] == row[c] ? 1.f : 0.f;
+        if (!sum.empty()) {
+            for (size_t c = 0; c < stride; ++c) sum[c] += row[c] == row[c] ? row[c] : 0.;
+            if (!sumSq.empty())
+                for (size_t c = 0; c < stride; ++c) sumSq[c] += row[c] == row[c] ? double(row[c]) * row[c] : 0.;
+        } else {
+            bool isMax = fn == window_fn::max;
+            for (size_t c = 0; c < stride; ++c) {
+                float v = row[c];
+                if (v != v) continue;
+                auto &dq(extremes[c]);
+                while (!dq.empty() && (isMax ? value(dq.back(), c) <= v : value(dq.back(), c) >= v)) dq.pop_back();
+                dq.push_back(seq);
+            }
+        }
+
+        evict();
+
+        switch (fn) {
+            case window_fn::sum:
+                for (size_t c = 0; c < stride; ++c) out[c] = cnt[c] > 0 ? static_cast<float>(sum[c]) : NAN;
+                break;
+            case window_fn::mean:
+                for (size_t c = 0; c < stride; ++c) out[c] = cnt[c] > 0 ? static_cast<float>(sum[c] / cnt[c]) : NAN;
+                break;
+            case window_fn::stddev:
+                for (size_t c = 0; c < stride; ++c) {
+                    double n = cnt[c];
+                    double var = (sumSq[c] - sum[c] * sum[c] / n) / (n - 1);
+                    out[c] = n > 1 ? static_cast<float>(std::sqrt(var > 0 ? var : 0.)) : NAN;
+                }
+                break;
+            default:
+                for (size_t c = 0; c < stride; ++c)
+                    out[c] = extremes[c].empty() ? NAN : value(extremes[c].front(), c);
+        }
+    }
+
+    size_t rolling_window::update(const series_view &in, series &out) {
+        if (in.stride() != stride) throw std::runtime_error("rolling window: column count changed");
+        if (in.num < consumed) throw std::runtime_error("rolling window: input series shrank");
+        if (out.columns.empty()) out.columns = in.columns();
+        out.dataStride = stride;
+        out.expandTime();
+        if (out.columnar) out.toRowMajor();
+
+        auto n = in.num - consumed;
+        out.time.reserve(out.num + n);
+        out.data.resize((out.num + n) * stride);
+        std::vector<float> gathered(in.isColumnar() ? stride : 0);
+        for (size_t r = consumed; r < in.num; ++r) {
+            const float *row = in.isColumnar() ? gathered.data() : in.row(r);
+            if (in.isColumnar()) {
+                for (size_t c = 0; c < stride; ++c) gathered[c] = in.at(r, c);
+            }
+            push(in.t(r), row, &out.data[out.num * stride]);
+            out.time.push_back(in.t(r));
+            ++out.num;
+        }
+        consumed = in.num;
+        return n;
+    }
+
+    series series::rolling(window_fn fn, window_size size) const {
+        return series_view(*this).rolling(fn, size);
+    }
+
+    series series_view::rolling(window_fn fn, window_size size) const {
+        series res{};
+        res.name = src->name;
+        res.tags = src->tags;
+        res.tagIds = src->tagIds;
+        rolling_window(fn, size, stride()).update(*this, res);
+        if (src->tIsCompact()) res.compactTime();
+        if (isColumnar()) res.toColumnar();
+        return res;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "client.h"
+
+namespace influxdb {
+
+    /**
+     * Streaming rolling-window aggregate over the rows of a series. Rows are pushed one by one (or all new rows of
+     * a growing series with update()), each push yields the aggregate of the window ending at that row.
+     * sum/mean/stddev keep running sums (O(1) per row), min/max a monotonic deque per column (O(1) amortized).
+     * Columns are independent, the per-row loops run element-wise over the columns.
+     */
+    class rolling_window {
+        window_fn fn;
+        window_size size;
+        size_t stride;
+
+        // rows in the window are [head, wTime.size()), their sequence number is dropped + position
+        std::vector<int64_t> wTime{};
+        std::vector<float> wData{};
+        size_t head = 0;
+        uint64_t dropped = 0;
+
+        std::vector<double> sum{}, sumSq{};
+        std::vector<float> cnt{};
+        std::vector<std::deque<uint64_t>> extremes{}; // per column, sequence numbers of the min/max candidates
+
+        size_t consumed = 0; // rows of the input series processed by update()
+
+        inline float value(uint64_t seq, size_t col) const {
+            return wData[static_cast<size_t>(seq - dropped) * stride + col];
+        }
+
+        void evict();
+
+    public:
+        rolling_window(window_fn fn, window_size size, size_t columns);
+
+        /**
+         * Adds a row at time t (not before the previous one) and writes the aggregate of the window to out.
+         */
+        void push(int64_t t, const float *row, float *out);
+
+        /**
+         * Pushes the rows of `in` that were not seen by a previous call and appends their results to `out`.
+         * Returns the number of appended rows.
+         */
+        size_t update(const series_view &in, series &out);
+
+        void reset();
+    };
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INFLUXDB_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace influxdb {
+    /**
+     * Byte scanning and number parsing shared by the text response decoders.
+     */
+    namespace scan {
+
+        inline unsigned ctz(uint32_t mask) {
+#ifdef _MSC_VER
+            unsigned long i;
+            _BitScanForward(&i, mask);
+            return i;
+#else
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+        }
+
+        inline const char *findByte(const char *p, const char *end, char c) {
+#ifdef INFLUXDB_SSE2
+            const __m128i needle = _mm_set1_epi8(c);
+            for (; p + 16 <= end; p += 16) {
+                auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), needle)));
+                if (mask) return p + ctz(mask);
+            }
+#endif
+            return static_cast<const char *>(std::memchr(p, c, static_cast<size_t>(end - p)));
+        }
+
+        /**
+         * Bit i is set if p[i] is one of a, b, c (i < 16).
+         */
+        inline uint32_t mask16(const char *p, char a, char b, char c) {
+#ifdef INFLUXDB_SSE2
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            auto m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)),
+                                               _mm_cmpeq_epi8(v, _mm_set1_epi8(b))),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+            return static_cast<uint32_t>(_mm_movemask_epi8(m));
+#else
+            uint32_t m = 0;
+            for (unsigned i = 0; i < 16; ++i) if (p[i] == a || p[i] == b || p[i] == c) m |= 1u << i;
+            return m;
+#endif
+        }
+
+        inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+        /**
+         * Parses a decimal number (JSON syntax). Up to 19 significant digits and a small exponent are converted
+         * exactly (Clinger's fast path), anything else goes through strtod.
+         */
+        inline const char *parseNumber(const char *p, const char *end, double &d) {
+            static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+                                           1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+            const char *begin = p;
+            bool neg = p < end && *p == '-';
+            if (neg) ++p;
+
+            uint64_t m = 0;
+            int digits = 0, exp10 = 0;
+            bool exact = true;
+            const char *firstDigit = p;
+            for (; p < end && isDigit(*p); ++p) {
+                if (digits < 19) {
+                    m = m * 10 + static_cast<unsigned>(*p - '0');
+                    if (m) ++digits;
+                } else {
+                    ++exp10;
+                    exact = false;
+                }
+            }
+            if (p == firstDigit) throw std::runtime_error("unexpected value, number expected");
+            if (p < end && *p == '.') {
+                for (++p; p < end && isDigit(*p); ++p) {
+                    if (digits < 19) {
+                        m = m * 10 + static_cast<unsigned>(*p - '0');
+                        if (m) ++digits;
+                        --exp10;
+                    } else exact = false;
+                }
+            }
+            if (p < end && (*p == 'e' || *p == 'E')) {
+                ++p;
+                bool eneg = p < end && *p == '-';
+                if (p < end && (*p == '-' || *p == '+')) ++p;
+                int e = 0;
+                for (; p < end && isDigit(*p); ++p) if (e < 10000) e = e * 10 + (*p - '0');
+                exp10 += eneg ? -e : e;
+            }
+
+            if (exact && m < (uint64_t(1) << 53u) && exp10 >= -22 && exp10 <= 22) {
+                d = exp10 < 0 ? static_cast<double>(m) / pow10[-exp10] : static_cast<double>(m) * pow10[exp10];
+                if (neg) d = -d;
+            } else {
+                std::string s(begin, p);
+                d = std::strtod(s.c_str(), nullptr);
+            }
+            return p;
+        }
+    }
+}
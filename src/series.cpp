@@ -1,7 +1,12 @@
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <functional>
+#include <numeric>
+#include <queue>
 #include "series.h"
+#include "fill.h"
+#include "gorilla.h"
 
 namespace influxdb {
     void series::joinInner(const series &other) {
@@ -13,35 +18,124 @@ namespace influxdb {
             if (selfA >= num) throw std::runtime_error("cannot join series with different sampling interval");
         }
 
-        std::vector<float> joint;
-        joint.reserve(data.size() + other.data.size());
-
         size_t k = 0;
         for (k = 0; k + selfA < num && k + otherA < other.num; ++k) {
             if (t(k + selfA) != other.t(k + otherA))
                 throw std::runtime_error("cannot join series with various sampling intervals");
-            std::copy(data.begin() + (selfA + k) * dataStride, data.begin() + (selfA + k + 1) * dataStride,
-                      std::back_inserter(joint));
-            std::copy(other.data.begin() + (otherA + k) * other.dataStride,
-                      other.data.begin() + (otherA + k + 1) * other.dataStride, std::back_inserter(joint));
         }
 
-        joint.shrink_to_fit();
+        auto stride = dataStride + other.dataStride;
+        std::vector<float> joint(k * stride);
+        if (!columnar) {
+            for (size_t r = 0; r < k; ++r) {
+                float *row = &joint[r * stride];
+                std::copy(data.begin() + (selfA + r) * dataStride, data.begin() + (selfA + r + 1) * dataStride, row);
+                if (!other.columnar)
+                    std::copy(other.data.begin() + (otherA + r) * other.dataStride,
+                              other.data.begin() + (otherA + r + 1) * other.dataStride, row + dataStride);
+                else
+                    for (size_t c = 0; c < other.dataStride; ++c) row[dataStride + c] = other.at(otherA + r, c);
+            }
+        } else {
+            for (size_t c = 0; c < dataStride; ++c)
+                std::copy(data.begin() + c * num + selfA, data.begin() + c * num + selfA + k, &joint[c * k]);
+            for (size_t c = 0; c < other.dataStride; ++c) {
+                auto col = other.column(c);
+                float *out = &joint[(dataStride + c) * k];
+                for (size_t r = 0; r < k; ++r) out[r] = col[otherA + r];
+            }
+        }
 
         num = k;
         std::copy(other.columns.begin() + 1, other.columns.end(), std::back_inserter(columns));
         dataStride += other.dataStride;
         data = std::move(joint);
 
-        // TODO time compacted!
-        time.erase(time.begin(), time.begin() + selfA);
-        time.erase(time.begin() + num, time.end());
+        sliceTime(selfA, num);
     }
 
 
-    series series::sortedMerge(std::vector<fetchResult> &results) {
+    series series::join(const std::vector<series_view> &inputs, join_mode mode, int64_t tolerance) {
+        series joined{};
+        if (inputs.empty()) return joined;
+
+        const series_view &base = inputs[0];
+        joined.columns.emplace_back(base.columns().empty() ? "time" : base.columns()[0]);
+        std::vector<size_t> offset;
+        for (const auto &in : inputs) {
+            offset.push_back(joined.dataStride);
+            joined.dataStride += in.stride();
+            if (!in.columns().empty())
+                joined.columns.insert(joined.columns.end(), in.columns().begin() + 1, in.columns().end());
+        }
+        auto stride = joined.dataStride;
+
+        auto copyRow = [&](size_t i, size_t row, float *out) {
+            const series_view &in = inputs[i];
+            if (!in.isColumnar()) std::memcpy(out, in.row(row), in.stride() * sizeof(float));
+            else for (size_t c = 0; c < in.stride(); ++c) out[c] = in.at(row, c);
+        };
+
+        std::vector<size_t> cur(inputs.size(), 0);
+
+        if (mode == join_mode::inner) {
+            size_t maxNum = base.num;
+            for (const auto &in : inputs) maxNum = std::min(maxNum, in.num);
+            joined.time.reserve(maxNum);
+            joined.data.reserve(maxNum * stride);
+
+            // leapfrog: move every cursor to the largest head time until all agree
+            bool done = maxNum == 0;
+            while (!done) {
+                int64_t target = base.t(cur[0]);
+                for (size_t i = 1; i < inputs.size(); ++i) target = std::max(target, inputs[i].t(cur[i]));
+
+                bool match = true;
+                for (size_t i = 0; i < inputs.size() && !done; ++i) {
+                    const series_view &in = inputs[i];
+                    while (cur[i] < in.num && in.t(cur[i]) < target) ++cur[i];
+                    if (cur[i] == in.num) done = true;
+                    else if (in.t(cur[i]) != target) match = false;
+                }
+                if (done || !match) continue;
+
+                joined.time.push_back(target);
+                joined.data.resize(joined.data.size() + stride);
+                float *out = joined.data.data() + joined.data.size() - stride;
+                for (size_t i = 0; i < inputs.size(); ++i) {
+                    copyRow(i, cur[i], out + offset[i]);
+                    if (++cur[i] == inputs[i].num) done = true;
+                }
+            }
+            joined.time.shrink_to_fit();
+            joined.data.shrink_to_fit();
+        } else {
+            if (mode == join_mode::leftOuter) tolerance = 0;
+            joined.time.resize(base.num);
+            joined.data.assign(base.num * stride, NAN);
+
+            for (size_t r = 0; r < base.num; ++r) {
+                auto T = base.t(r);
+                joined.time[r] = T;
+                float *out = joined.data.data() + r * stride;
+                copyRow(0, r, out);
+                for (size_t i = 1; i < inputs.size(); ++i) {
+                    const series_view &in = inputs[i];
+                    while (cur[i] + 1 < in.num && in.t(cur[i] + 1) <= T) ++cur[i];
+                    if (cur[i] < in.num && in.t(cur[i]) <= T && T - in.t(cur[i]) <= tolerance)
+                        copyRow(i, cur[i], out + offset[i]);
+                }
+            }
+        }
+
+        joined.num = joined.time.size();
+        if (base.src->tIsCompact()) joined.compactTime();
+        return joined;
+    }
+
+    series series::sortedMerge(std::vector<fetchResult> &results, dedup_policy policy) {
 
-        // remove empty series
+        // remove empty series (keeping the order, it matters for dedup)
         results.erase(std::remove_if(results.begin(), results.end(), [](const fetchResult &r) {
             return r.num == 0;
         }), results.end());
@@ -50,64 +144,205 @@ namespace influxdb {
         if (results.empty())
             return resultMerged;
 
-        std::sort(results.begin(), results.end(), [](const fetchResult &a, const fetchResult &b) {
-            return a.t(0) < b.t(0);
+        if (results[0].columns.empty()) throw std::runtime_error("sortedMerge: no columns!");
+
+        std::vector<size_t> order(results.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&results](size_t a, size_t b) {
+            return results[a].t(0) < results[b].t(0);
         });
 
-        // LOG_D << LOG_EXPR(results.size());
-        // strip overlaps TODO
-        for (auto i = 0; (i + 1) < results.size(); ++i) {
-            if (results[i].tEnd() >= results[i + 1].t(0)) {
-                LOG_D << LOG_EXPR(i) << LOG_EXPR(results[i].tEnd()) << LOG_EXPR(results[i + 1].t(0))
-                      << LOG_EXPR(results[i].tEnd() - results[i + 1].t(0));
-                throw std::logic_error("cant merge time-overlapping results!");
+        // both paths merge row-major, the result gets the layout of the earliest input
+        bool columnar = results[order[0]].isColumnar();
+        for (size_t i = 0; (i + 1) < order.size(); ++i) {
+            if (results[order[i]].tEnd() >= results[order[i + 1]].t(0)) {
+                auto merged = kWayMerge(results, policy);
+                if (columnar) merged.toColumnar();
+                return merged;
             }
         }
 
+        // a single result is moved. Otherwise the rows are concatenated row-major into buffers reserved once (a
+        // columnar append moves all earlier rows) and transposed back once if the inputs were columnar.
+        if (results.size() > 1) {
+            size_t num = 0;
+            for (auto &r : results) {
+                num += r.num;
+                r.toRowMajor();
+            }
+            resultMerged.time.reserve(num);
+            resultMerged.data.reserve(num * (results[0].columns.size() - 1));
+        }
 
-        for (auto &r : results)
-            resultMerged.num += r.num;
-        auto columns = results[0].columns;
+        for (auto i : order)
+            resultMerged.append(std::move(results[i]));
 
-        if (columns.empty()) throw std::runtime_error("sortedMerge: no columns!");
+        if (columnar) resultMerged.toColumnar();
+        return resultMerged;
+    }
 
-        //LOG_W << LOG_EXPR(columns.size());
-        resultMerged.dataStride = (columns.size() - 1);
-        resultMerged.columns = columns;
-        resultMerged.time.resize(resultMerged.num);
-        // LOG_W << LOG_EXPR(columns.size()) << LOG_EXPR(resultMerged.num) << LOG_EXPR(resultMerged.dataStride);
-        resultMerged.data.resize(resultMerged.num * resultMerged.dataStride);
+    series series::kWayMerge(std::vector<series> &results, dedup_policy policy) {
+        series merged{};
+        merged.columns = results[0].columns;
+        merged.dataStride = results[0].dataStride;
+        auto stride = merged.dataStride;
+        bool compact = true;
 
-        size_t offset = 0;
+        size_t total = 0;
         for (auto &r : results) {
-            std::move(r.time.begin(), r.time.end(), resultMerged.time.begin() + offset);
-            std::move(r.data.begin(), r.data.end(), resultMerged.data.begin() + (offset * resultMerged.dataStride));
-            offset += r.num;
+            if (r.columns != merged.columns) throw std::runtime_error("sortedMerge: series with different columns");
+            r.toRowMajor();
+            compact = compact && r.tIsCompact();
+            total += r.num;
         }
-
-        /*
-        //for(auto &r: results) {
-        uint64_t lastT = 0, i = 0;
-        for (auto t:resultMerged.time) {
-            if (t < lastT) {
-                LOG_W << i << " " << LOG_EXPR(t) << LOG_EXPR(lastT) << LOG_EXPR((lastT - t) / 1e3);
+        merged.time.reserve(total);
+        merged.data.reserve(total * stride);
+
+        struct head {
+            int64_t t;
+            size_t input, row;
+        };
+        // min-heap on (time, input), so equal timestamps come out in input order
+        auto later = [](const head &a, const head &b) { return a.t != b.t ? a.t > b.t : a.input > b.input; };
+        std::priority_queue<head, std::vector<head>, decltype(later)> heap(later);
+        for (size_t i = 0; i < results.size(); ++i) heap.push({results[i].t(0), i, 0});
+
+        auto next = [&](const head &h) {
+            auto &r = results[h.input];
+            if (h.row + 1 < r.num) heap.push({r.t(h.row + 1), h.input, h.row + 1});
+        };
+
+        while (!heap.empty()) {
+            auto h = heap.top();
+            heap.pop();
+            const float *row = results[h.input].data.data() + h.row * stride;
+            merged.time.push_back(h.t);
+            merged.data.insert(merged.data.end(), row, row + stride);
+            next(h);
+
+            while (!heap.empty() && heap.top().t == h.t) {
+                auto d = heap.top();
+                heap.pop();
+                const float *dup = results[d.input].data.data() + d.row * stride;
+                float *out = merged.data.data() + merged.data.size() - stride;
+                switch (policy) {
+                    case dedup_policy::first:
+                        break;
+                    case dedup_policy::last:
+                        std::copy(dup, dup + stride, out);
+                        break;
+                    case dedup_policy::preferValid:
+                        for (size_t c = 0; c < stride; ++c) if (std::isnan(out[c])) out[c] = dup[c];
+                        break;
+                }
+                next(d);
             }
-            lastT = t;
-            ++i;
-        }*/
-        // }
+        }
 
-        // fill NaNs with previous
-        for (size_t i = 1; i < resultMerged.num; ++i) {
-            for (size_t c = 0; c < resultMerged.dataStride; ++c) {
-                if (std::isnan(resultMerged.data[i * resultMerged.dataStride + c])) {
-                    resultMerged.data[i * resultMerged.dataStride + c] = resultMerged.data[
-                            (i - 1) * resultMerged.dataStride + c];
-                }
+        for (auto &r : results) r = series{};
+
+        merged.num = merged.time.size();
+        merged.time.shrink_to_fit();
+        merged.data.shrink_to_fit();
+        merged.fillForwardFrom(0);
+        if (compact) merged.compactTime();
+        return merged;
+    }
+
+    void series::append(series &&other) {
+        if (other.num == 0) return;
+
+        if (num == 0 && time.capacity() == 0 && data.capacity() == 0) {
+            *this = std::move(other);
+            other.clear();
+            fillForwardFrom(0);
+            return;
+        }
+
+        if (num == 0 && columns.empty()) {
+            columns = other.columns;
+            dataStride = other.dataStride;
+        }
+        if (other.columns != columns) throw std::runtime_error("append: series with different columns");
+        if (num > 0 && other.t(0) <= tEnd()) throw std::logic_error("cant merge time-overlapping results!");
+
+        if (num == 0 && other.tIsCompact()) {
+            time.clear();
+            tStart = other.tStart, tInterval = other.tInterval, tSegments = other.tSegments;
+        } else if (tIsCompact() && other.tInterval == tInterval) {
+            if (other.tStart != tEnd() + tInterval) tSegments.emplace_back(num, other.tStart);
+            for (auto &seg : other.tSegments) tSegments.emplace_back(seg.first + num, seg.second);
+        } else {
+            expandTime();
+            other.expandTime();
+            time.insert(time.end(), other.time.begin(), other.time.end());
+        }
+
+        if (num == 0) columnar = other.columnar;
+        if (other.columnar != columnar) columnar ? other.toColumnar() : other.toRowMajor();
+        if (!columnar) {
+            data.insert(data.end(), other.data.begin(), other.data.end());
+        } else {
+            // every column but the first moves to its new offset, so this is O(num) for each append. Columns only
+            // move right, the last one goes first. sortedMerge() appends row-major instead.
+            auto total = num + other.num;
+            data.resize(total * dataStride);
+            for (size_t c = dataStride; c-- > 1;)
+                std::copy_backward(data.begin() + c * num, data.begin() + (c + 1) * num, data.begin() + c * total + num);
+            for (size_t c = 0; c < dataStride; ++c)
+                std::copy(other.data.begin() + c * other.num, other.data.begin() + (c + 1) * other.num,
+                          data.begin() + c * total + num);
+        }
+
+        auto first = num;
+        num += other.num;
+        fillForwardFrom(first);
+
+        other.clear();
+        other.time.shrink_to_fit();
+        other.data.shrink_to_fit();
+    }
+
+    void series::append(const series_view &other) {
+        if (other.num == 0) return;
+        // a columnar side moves columns around anyway (see above), an intermediate copy does not matter there
+        if (columnar || other.columnar) {
+            append(other.toSeries());
+            return;
+        }
+
+        auto &src = *other.src;
+        if (num == 0 && columns.empty()) {
+            name = src.name, tags = src.tags, tagIds = src.tagIds;
+            columns = src.columns;
+            dataStride = other.dataStride;
+        }
+        if (src.columns != columns) throw std::runtime_error("append: series with different columns");
+        if (num > 0 && other.t(0) <= tEnd()) throw std::logic_error("cant merge time-overlapping results!");
+
+        // compact time of all rows of its storage (a mapped file) stays compact
+        bool otherCompact = !other.time && other.offset == 0 && other.num == other.rowsTotal;
+        if (num == 0 && otherCompact) {
+            time.clear();
+            tStart = src.tStart, tInterval = src.tInterval, tSegments = src.tSegments;
+        } else if (tIsCompact() && otherCompact && src.tInterval == tInterval) {
+            if (src.tStart != tEnd() + tInterval) tSegments.emplace_back(num, src.tStart);
+            for (auto &seg : src.tSegments) tSegments.emplace_back(seg.first + num, seg.second);
+        } else {
+            expandTime();
+            if (other.time) {
+                time.insert(time.end(), other.time + other.offset, other.time + other.offset + other.num);
+            } else {
+                time.reserve(num + other.num);
+                for (size_t i = 0; i < other.num; ++i) time.push_back(other.t(i));
             }
         }
 
-        return resultMerged;
+        data.insert(data.end(), other.row(0), other.row(0) + other.num * dataStride);
+
+        auto first = num;
+        num += other.num;
+        fillForwardFrom(first);
     }
 
 
@@ -116,16 +351,71 @@ namespace influxdb {
             for (size_t c = 0; c < len; ++c) {
                 if (std::isnan(d[c])) return false;
             }
+            return true;
         });
     }
 
+    void series::toColumnar() {
+        if (columnar) return;
+        std::vector<float> cols(data.size());
+        constexpr size_t block = 64; // rows per block, keeps the written column segments in cache
+        for (size_t r0 = 0; r0 < num; r0 += block) {
+            auto r1 = std::min(num, r0 + block);
+            for (size_t c = 0; c < dataStride; ++c)
+                for (size_t r = r0; r < r1; ++r) cols[c * num + r] = data[r * dataStride + c];
+        }
+        data = std::move(cols);
+        columnar = true;
+    }
+
+    void series::toRowMajor() {
+        if (!columnar) return;
+        std::vector<float> rows(data.size());
+        constexpr size_t block = 64;
+        for (size_t r0 = 0; r0 < num; r0 += block) {
+            auto r1 = std::min(num, r0 + block);
+            for (size_t c = 0; c < dataStride; ++c)
+                for (size_t r = r0; r < r1; ++r) rows[r * dataStride + c] = data[c * num + r];
+        }
+        data = std::move(rows);
+        columnar = false;
+    }
+
+    void series::eraseRows(size_t start, size_t count) {
+        if (!columnar) {
+            data.erase(data.begin() + start * dataStride, data.begin() + (start + count) * dataStride);
+            return;
+        }
+        size_t w = 0;
+        for (size_t c = 0; c < dataStride; ++c) {
+            for (size_t r = 0; r < num; ++r) {
+                if (r < start || r >= start + count) data[w++] = data[c * num + r];
+            }
+        }
+        data.resize(w);
+    }
+
+    size_t series::fillForwardFrom(size_t row) {
+        if (row >= num) return 0;
+        auto from = row > 0 ? row - 1 : 0;
+        if (!columnar) return fillForward(data.data() + from * dataStride, num - from, dataStride);
+        size_t filled = 0;
+        for (size_t c = 0; c < dataStride; ++c) filled += fillForward(data.data() + c * num + from, num - from, 1);
+        return filled;
+    }
+
     void series::erase(size_t start, size_t count) {
         //LOG_D << __FUNCTION__ << LOG_EXPR(start) << LOG_EXPR(count);
 
         if (start + count > num) throw std::logic_error("erase: out of range");
+        if (start == 0) sliceTime(count, num - count);
+        else if (start + count == num) sliceTime(0, start);
+        else {
+            expandTime();
+            time.erase(time.begin() + start, time.begin() + (start + count));
+        }
+        eraseRows(start, count);
         num -= count;
-        data.erase(data.begin() + start, data.begin() + (start + count) * dataStride);
-        time.erase(time.begin() + start, time.begin() + (start + count));
         checkNum();
     }
 
@@ -134,9 +424,17 @@ namespace influxdb {
 
         //if(start < 2) throw std::logic_error("insert: can only insert after first 2 samples");
         //if(num < 2) throw std::logic_error("insert: series must have at least 2 samples");
+        if (columnar) {
+            toRowMajor();
+            auto it = insert(start, count);
+            toColumnar();
+            return it;
+        }
+
+        expandTime();
         num += count;
-        data.insert(data.begin() + start, dataStride * count, 0);
-        time.insert(time.begin() + start, count, 0); // todo time compact
+        data.insert(data.begin() + start * dataStride, dataStride * count, 0);
+        time.insert(time.begin() + start, count, 0);
 
         checkNum();
 
@@ -146,8 +444,77 @@ namespace influxdb {
         //    time[start + i] =  i * si;
     }
 
+    int64_t series::tSegmented(size_t frame) const {
+        auto seg = std::upper_bound(tSegments.begin(), tSegments.end(), frame,
+                                    [](size_t f, const std::pair<size_t, int64_t> &s) { return f < s.first; });
+        if (seg == tSegments.begin()) return tStart + static_cast<int64_t>(frame) * tInterval;
+        --seg;
+        return seg->second + static_cast<int64_t>(frame - seg->first) * tInterval;
+    }
+
+    bool series::compactTime() {
+        if (tIsCompact()) return true;
+        if (num < 2 || time.size() != num) return false;
+        auto si = time[1] - time[0];
+        if (si <= 0) return false;
+
+        std::vector<std::pair<size_t, int64_t>> segments;
+        size_t segRow = 0;
+        int64_t segTime = time[0];
+        for (size_t i = 2; i < num; ++i) {
+            if (time[i] != segTime + static_cast<int64_t>(i - segRow) * si) {
+                if (segments.size() >= num / 16) return false;
+                segRow = i, segTime = time[i];
+                segments.emplace_back(segRow, segTime);
+            }
+        }
+
+        tStart = time[0];
+        tInterval = si;
+        tSegments = std::move(segments);
+        time.clear();
+        time.shrink_to_fit();
+        return true;
+    }
+
+    std::vector<int64_t> series::timeVector() const {
+        if (!tIsCompact()) return time;
+        std::vector<int64_t> dense(num);
+        for (size_t i = 0; i < num; ++i) dense[i] = t(i);
+        return dense;
+    }
+
+    void series::expandTime() {
+        if (!tIsCompact()) return;
+        time.resize(num);
+        for (size_t i = 0; i < num; ++i) time[i] = t(i);
+        tInterval = 0;
+        tSegments.clear();
+        tSegments.shrink_to_fit();
+    }
+
+    void series::sliceTime(size_t start, size_t count) {
+        if (!tIsCompact()) {
+            time.erase(time.begin() + start + count, time.end());
+            time.erase(time.begin(), time.begin() + start);
+            return;
+        }
+        if (count > 0) tStart = t(start);
+        std::vector<std::pair<size_t, int64_t>> segments;
+        for (auto &seg : tSegments) {
+            if (seg.first > start && seg.first < start + count) segments.emplace_back(seg.first - start, seg.second);
+        }
+        tSegments = std::move(segments);
+    }
+
     size_t series::fill(const std::function<bool(const float *, size_t)> &pred) {
         if (num < 2) return 0;
+        if (columnar) {
+            toRowMajor();
+            auto filled = fill(pred);
+            toColumnar();
+            return filled;
+        }
 
         size_t filled = 0;
 
@@ -169,47 +536,236 @@ namespace influxdb {
     size_t series::fill() {
         if (num < 2) return 0;
 
-        size_t filled = 0;
-
         // fill NaNs with previous
-        for (size_t i = 1; i < num; ++i) {
-            for (size_t c = 0; c < dataStride; ++c) {
-                if (std::isnan(data[i * dataStride + c])) {
-                    data[i * dataStride + c] = data[(i - 1) * dataStride + c];
-                    ++filled;
-                }
-            }
-        }
+        size_t filled = fillForwardFrom(0);
 
         filled += fillTimeGaps();
 
         return filled;
     }
 
-    size_t series::fillTimeGaps() {
-        size_t filled = 0;
+    size_t series::fillTimeGaps(fill_mode mode, float value) {
+        if (num < 2) return 0;
+        if (tIsCompact()) {
+            if (tSegments.empty()) return 0; // regular, no gaps
+            expandTime();
+            auto filled = fillTimeGaps(mode, value);
+            compactTime();
+            return filled;
+        }
         auto si = t(1) - t(0);
-        auto lastT = t(0);
+        if (si <= 0) throw std::runtime_error("unexpected time jump backwards");
+
+        // count missing frames
+        size_t missing = 0;
         for (size_t i = 1; i < num; ++i) {
-            auto nIns = (t(i) - lastT) / si - 1;
-            if (nIns != 0) {
-                if (nIns < 0) throw std::runtime_error("unexpected time jump backwards");
-                // insert repeating previous
-                time.insert(time.begin() + i, static_cast<size_t>(nIns), 0);
-                data.insert(data.begin() + i * dataStride, nIns * dataStride, 0.f);
-                for (size_t j = 0; j < nIns; ++j) {
-                    time[i + j] = lastT + (1 + j) * si;
-                    for (size_t c = 0; c < dataStride; ++c) {
-                        data[(i + j) * dataStride + c] = data[(i - 1) * dataStride + c];
+            auto nIns = (t(i) - t(i - 1)) / si - 1;
+            if (nIns < 0) throw std::runtime_error("unexpected time jump backwards");
+            missing += static_cast<size_t>(nIns);
+        }
+        if (missing == 0) return 0;
+        if (columnar) {
+            toRowMajor();
+            auto filled = fillTimeGaps(mode, value);
+            toColumnar();
+            return filled;
+        }
+
+        std::vector<int64_t> filledTime(num + missing);
+        std::vector<float> filledData((num + missing) * dataStride);
+        auto rowBytes = dataStride * sizeof(float);
+
+        // copy runs of present frames, write each gap once
+        size_t o = 0, runStart = 0;
+        auto copyRun = [&](size_t end) {
+            auto n = end - runStart;
+            std::memcpy(&filledTime[o], &time[runStart], n * sizeof(int64_t));
+            std::memcpy(&filledData[o * dataStride], &data[runStart * dataStride], n * rowBytes);
+            o += n;
+        };
+        for (size_t i = 1; i < num; ++i) {
+            auto nIns = static_cast<size_t>((t(i) - t(i - 1)) / si - 1);
+            if (nIns == 0) continue;
+            copyRun(i);
+            runStart = i;
+            const float *prev = &data[(i - 1) * dataStride], *next = &data[i * dataStride];
+            for (size_t j = 0; j < nIns; ++j, ++o) {
+                filledTime[o] = t(i - 1) + static_cast<int64_t>(1 + j) * si;
+                float *row = &filledData[o * dataStride];
+                switch (mode) {
+                    case fill_mode::previous:
+                        std::memcpy(row, prev, rowBytes);
+                        break;
+                    case fill_mode::constant:
+                        std::fill(row, row + dataStride, value);
+                        break;
+                    case fill_mode::linear: {
+                        float w = static_cast<float>(1 + j) / static_cast<float>(1 + nIns);
+                        for (size_t c = 0; c < dataStride; ++c) row[c] = prev[c] + (next[c] - prev[c]) * w;
+                        break;
                     }
                 }
-                num += nIns;
-                i += nIns;
-                filled += nIns;
             }
-            lastT = t(i);
         }
-        return filled;
+        copyRun(num);
+
+        time = std::move(filledTime);
+        data = std::move(filledData);
+        num += missing;
+        return missing;
+    }
+
+    namespace {
+        /**
+         * Accumulates `rows` rows of `width` values (`rowStride` apart) into acc/cnt. The inner loops run element-wise
+         * over the columns of a row and are branch-free, so they vectorize.
+         */
+        void accumulate(aggregator agg, const float *p, size_t rows, size_t rowStride, size_t width,
+                        float *__restrict acc, float *__restrict cnt) {
+            switch (agg) {
+                case aggregator::first:
+                    std::memcpy(acc, p, width * sizeof(float));
+                    break;
+                case aggregator::last:
+                    std::memcpy(acc, p + (rows - 1) * rowStride, width * sizeof(float));
+                    break;
+                case aggregator::min:
+                    for (size_t r = 0; r < rows; ++r, p += rowStride) {
+                        for (size_t c = 0; c < width; ++c) {
+                            acc[c] = p[c] < acc[c] ? p[c] : acc[c]; // false for NaN
+                            cnt[c] += p[c] == p[c] ? 1.f : 0.f;
+                        }
+                    }
+                    break;
+                case aggregator::max:
+                    for (size_t r = 0; r < rows; ++r, p += rowStride) {
+                        for (size_t c = 0; c < width; ++c) {
+                            acc[c] = p[c] > acc[c] ? p[c] : acc[c];
+                            cnt[c] += p[c] == p[c] ? 1.f : 0.f;
+                        }
+                    }
+                    break;
+                default: // mean, sum, count
+                    for (size_t r = 0; r < rows; ++r, p += rowStride) {
+                        for (size_t c = 0; c < width; ++c) {
+                            bool valid = p[c] == p[c];
+                            acc[c] += valid ? p[c] : 0.f;
+                            cnt[c] += valid ? 1.f : 0.f;
+                        }
+                    }
+            }
+        }
+
+        float finalize(aggregator agg, float acc, float cnt) {
+            switch (agg) {
+                case aggregator::first:
+                case aggregator::last:
+                    return acc;
+                case aggregator::count:
+                    return cnt;
+                case aggregator::mean:
+                    return cnt > 0 ? acc / cnt : NAN;
+                default:
+                    return cnt > 0 ? acc : NAN;
+            }
+        }
+    }
+
+    series series::resample(int64_t interval, aggregator agg) const {
+        return series_view(*this).resample(interval, agg);
+    }
+
+    series series_view::resample(int64_t interval, aggregator agg) const {
+        if (interval <= 0) throw std::runtime_error("resample interval must be positive");
+
+        series res{};
+        res.name = src->name;
+        res.tags = src->tags;
+        res.tagIds = src->tagIds;
+        res.columns = src->columns;
+        auto dataStride = res.dataStride = stride();
+        if (num == 0) return res;
+
+        // bucket boundaries, one division per bucket
+        std::vector<size_t> starts;
+        int64_t bucketStart = 0, bucketEnd = 0;
+        for (size_t r = 0; r < num; ++r) {
+            auto tr = t(r);
+            if (r > 0 && tr >= bucketStart && tr < bucketEnd) continue;
+            bucketStart = tr / interval * interval;
+            if (bucketStart > tr) bucketStart -= interval; // floor for negative times
+            bucketEnd = bucketStart + interval;
+            starts.push_back(r);
+            res.time.push_back(bucketStart);
+        }
+        auto buckets = starts.size();
+        starts.push_back(num);
+
+        res.num = buckets;
+        res.columnar = isColumnar();
+        res.data.resize(buckets * dataStride);
+
+        float init = agg == aggregator::min ? INFINITY : agg == aggregator::max ? -INFINITY : 0.f;
+        std::vector<float> acc(dataStride), cnt(dataStride);
+        for (size_t b = 0; b < buckets; ++b) {
+            auto r0 = starts[b], rows = starts[b + 1] - r0;
+            std::fill(acc.begin(), acc.end(), init);
+            std::fill(cnt.begin(), cnt.end(), 0.f);
+            if (isColumnar()) {
+                for (size_t c = 0; c < dataStride; ++c)
+                    accumulate(agg, &column(c)[r0], rows, 1, 1, &acc[c], &cnt[c]);
+            } else {
+                accumulate(agg, row(r0), rows, dataStride, dataStride, acc.data(), cnt.data());
+            }
+            for (size_t c = 0; c < dataStride; ++c) res.at(b, c) = finalize(agg, acc[c], cnt[c]);
+        }
+
+        res.compactTime();
+        return res;
+    }
+
+    size_t series_view::lowerBound(int64_t t0) const {
+        size_t lo = 0, hi = num;
+        while (lo < hi) {
+            auto mid = lo + (hi - lo) / 2;
+            if (t(mid) < t0) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    series_view series_view::slice(int64_t t0, int64_t t1) const {
+        auto start = lowerBound(t0);
+        auto end = std::max(start, lowerBound(t1));
+        return rows(start, end - start);
+    }
+
+    series_view series::slice(int64_t t0, int64_t t1) const {
+        return series_view(*this).slice(t0, t1);
+    }
+
+    series series_view::toSeries() const {
+        series copy{};
+        copy.name = src->name;
+        copy.tags = src->tags;
+        copy.tagIds = src->tagIds;
+        copy.columns = src->columns;
+        copy.dataStride = stride();
+        copy.num = num;
+        copy.columnar = isColumnar();
+
+        copy.time.resize(num);
+        for (size_t i = 0; i < num; ++i) copy.time[i] = t(i);
+        if (src->tIsCompact()) copy.compactTime();
+
+        if (isColumnar()) {
+            copy.data.resize(num * stride());
+            for (size_t c = 0; c < stride(); ++c)
+                std::memcpy(&copy.data[c * num], &column(c)[0], num * sizeof(float));
+        } else {
+            copy.data.assign(row(0), row(0) + num * stride());
+        }
+        return copy;
     }
 
     /*
@@ -256,4 +812,179 @@ namespace influxdb {
 
 
 
-}
\ No newline at end of file
+
+    uint64_t seriesChecksum(uint64_t h, const void *p, size_t len) {
+        constexpr uint64_t k = 0x9e3779b97f4a7c15ull;
+        auto rotl = [](uint64_t x, unsigned r) { return (x << r) | (x >> (64u - r)); };
+        const auto *b = static_cast<const unsigned char *>(p);
+
+        // 4 independent lanes of 8-byte words
+        uint64_t lane[4] = {h ^ len, h + k, h - k, ~h};
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            for (size_t j = 0; j < 4; ++j) {
+                uint64_t w;
+                std::memcpy(&w, b + i + 8 * j, 8);
+                lane[j] = (lane[j] ^ w) * k;
+                lane[j] ^= lane[j] >> 29u;
+            }
+        }
+        h = lane[0] ^ rotl(lane[1], 17) ^ rotl(lane[2], 31) ^ rotl(lane[3], 47);
+        for (; i < len; ++i) h = (h ^ b[i]) * 0x100000001b3ull;
+        return h ^ (h >> 32u);
+    }
+
+    void series::parseFileMeta(const char *p, size_t len, series &fr) {
+        const char *end = p + len;
+        auto getInt = [&]() {
+            uint64_t v;
+            if (end - p < 8) throw std::runtime_error("invalid series file metadata");
+            std::memcpy(&v, p, 8);
+            p += 8;
+            return v;
+        };
+        auto getString = [&]() {
+            auto n = getInt();
+            if (static_cast<uint64_t>(end - p) < n) throw std::runtime_error("invalid series file metadata");
+            std::string str(p, n);
+            p += n;
+            return str;
+        };
+
+        fr.name = getString();
+        fr.tags.clear();
+        for (auto n = getInt(); n > 0; --n) {
+            auto key = getString();
+            fr.tags.emplace(std::move(key), getString());
+        }
+        fr.columns.clear();
+        for (auto n = getInt(); n > 0; --n) fr.columns.push_back(getString());
+    }
+
+    void writeSeries(std::ostream &s, const series &fr, bool compress) {
+        if (fr.data.size() != fr.num * fr.dataStride) throw std::runtime_error("writeSeries: unexpected data size");
+
+        std::string meta;
+        auto putInt = [&meta](uint64_t v) { meta.append(reinterpret_cast<const char *>(&v), 8); };
+        auto putString = [&](const std::string &str) {
+            putInt(str.size());
+            meta += str;
+        };
+        putString(fr.name);
+        putInt(fr.tags.size());
+        for (auto &kv : fr.tags) putString(kv.first), putString(kv.second);
+        putInt(fr.columns.size());
+        for (auto &col : fr.columns) putString(col);
+
+        series_file_header h{};
+        std::memcpy(h.magic, series_file_header::magicString(), sizeof(h.magic));
+        h.version = series_file_header::Version;
+        h.num = fr.num;
+        h.dataStride = fr.dataStride;
+        h.metaLen = meta.size();
+        if (fr.columnar) h.flags |= series_file_header::Columnar;
+
+        static const char zeros[series_file_header::Align] = {};
+        if (compress) {
+            h.flags |= series_file_header::Gorilla;
+            if (fr.tIsCompact()) h.flags |= series_file_header::CompactTime;
+            std::string enc;
+            gorilla::encode(fr, enc);
+            uint64_t encLen = enc.size();
+            h.checksum = seriesChecksum(seriesChecksum(0, meta.data(), meta.size()), enc.data(), enc.size());
+            s.write(reinterpret_cast<const char *>(&h), sizeof(h));
+            s.write(meta.data(), static_cast<std::streamsize>(meta.size()));
+            s.write(zeros, static_cast<std::streamsize>(h.timeOffset() - sizeof(h) - meta.size()));
+            _write(s, encLen);
+            s.write(enc.data(), static_cast<std::streamsize>(enc.size()));
+            return;
+        }
+
+        // a segmented grid is stored dense
+        const int64_t *time = nullptr;
+        std::vector<int64_t> expanded;
+        if (fr.tIsCompact() && fr.tSegments.empty()) {
+            h.flags |= series_file_header::CompactTime;
+            h.tStart = fr.tStart;
+            h.tInterval = fr.tInterval;
+        } else if (fr.tIsCompact()) {
+            expanded.resize(fr.num);
+            for (size_t i = 0; i < fr.num; ++i) expanded[i] = fr.t(i);
+            time = expanded.data();
+        } else {
+            time = fr.time.data();
+        }
+        size_t timeBytes = time ? fr.num * sizeof(int64_t) : 0, dataBytes = fr.data.size() * sizeof(float);
+
+        h.checksum = seriesChecksum(seriesChecksum(seriesChecksum(0, meta.data(), meta.size()), time, timeBytes),
+                                    fr.data.data(), dataBytes);
+
+        s.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        s.write(meta.data(), static_cast<std::streamsize>(meta.size()));
+        s.write(zeros, static_cast<std::streamsize>(h.timeOffset() - sizeof(h) - meta.size()));
+        s.write(reinterpret_cast<const char *>(time), static_cast<std::streamsize>(timeBytes));
+        s.write(zeros, static_cast<std::streamsize>(h.dataOffset() - h.timeOffset() - timeBytes));
+        s.write(reinterpret_cast<const char *>(fr.data.data()), static_cast<std::streamsize>(dataBytes));
+    }
+
+    void readSeries(std::istream &s, series &fr) {
+        series_file_header h{};
+        s.read(reinterpret_cast<char *>(&h), sizeof(h));
+        if (!s.good() || std::memcmp(h.magic, series_file_header::magicString(), sizeof(h.magic)) != 0)
+            throw std::runtime_error("invalid series file header");
+        if (h.version != series_file_header::Version)
+            throw std::runtime_error("unsupported series file version " + std::to_string(h.version));
+        if (h.metaLen > (1u << 24u) || h.num > (1ull << 40u) || h.dataStride > (1u << 20u)
+            || ((h.flags & series_file_header::CompactTime) && !(h.flags & series_file_header::Gorilla)
+                && h.tInterval == 0))
+            throw std::runtime_error("invalid series file header");
+
+        std::string meta(h.metaLen, '\0');
+        s.read(&meta[0], static_cast<std::streamsize>(meta.size()));
+        series::parseFileMeta(meta.data(), meta.size(), fr);
+        s.ignore(static_cast<std::streamsize>(h.timeOffset() - sizeof(h) - meta.size()));
+
+        fr.num = h.num;
+        fr.dataStride = h.dataStride;
+        fr.columnar = (h.flags & series_file_header::Columnar) != 0;
+        fr.tSegments.clear();
+
+        if (h.flags & series_file_header::Gorilla) {
+            uint64_t encLen = 0;
+            _readVal(s, encLen);
+            if (!s.good() || encLen > h.maxEncodedSize()) throw std::runtime_error("invalid series file header");
+            std::string enc(encLen, '\0');
+            s.read(&enc[0], static_cast<std::streamsize>(encLen));
+            if (s.fail()) throw std::runtime_error("stream fail after fetchResult read");
+            if (seriesChecksum(seriesChecksum(0, meta.data(), meta.size()), enc.data(), enc.size()) != h.checksum)
+                throw std::runtime_error("series file checksum mismatch");
+            fr.tInterval = 0;
+            fr.time.resize(fr.num);
+            fr.data.resize(fr.num * fr.dataStride);
+            gorilla::decode(enc.data(), enc.size(), fr.num, fr.dataStride, fr.time.data(), fr.data.data(),
+                            fr.columnar);
+            if (h.flags & series_file_header::CompactTime) fr.compactTime();
+            return;
+        }
+
+        size_t timeBytes = 0;
+        if (h.flags & series_file_header::CompactTime) {
+            fr.time.clear();
+            fr.tStart = h.tStart;
+            fr.tInterval = h.tInterval;
+        } else {
+            fr.tInterval = 0;
+            fr.time.resize(fr.num);
+            timeBytes = fr.num * sizeof(int64_t);
+            s.read(reinterpret_cast<char *>(fr.time.data()), static_cast<std::streamsize>(timeBytes));
+        }
+        s.ignore(static_cast<std::streamsize>(h.dataOffset() - h.timeOffset() - timeBytes));
+        fr.data.resize(fr.num * fr.dataStride);
+        s.read(reinterpret_cast<char *>(fr.data.data()), static_cast<std::streamsize>(fr.data.size() * sizeof(float)));
+        if (s.fail()) throw std::runtime_error("stream fail after fetchResult read");
+
+        auto sum = seriesChecksum(seriesChecksum(seriesChecksum(0, meta.data(), meta.size()), fr.time.data(),
+                                                 timeBytes), fr.data.data(), fr.data.size() * sizeof(float));
+        if (sum != h.checksum) throw std::runtime_error("series file checksum mismatch");
+    }
+}
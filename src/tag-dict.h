@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../farmhash/src/farmhash.h"
+
+namespace influxdb {
+
+    /**
+     * Interned tag set of a series: (key id, value id) pairs of a tag_dict, sorted by key id. Two series have the
+     * same tags iff their tag_ids are equal.
+     */
+    typedef std::vector<uint32_t> tag_ids;
+
+    struct tag_ids_hash {
+        size_t operator()(const tag_ids &ids) const {
+            return static_cast<size_t>(::util::Hash64(reinterpret_cast<const char *>(ids.data()),
+                                                      ids.size() * sizeof(uint32_t)));
+        }
+    };
+
+    /**
+     * Thread-safe string dictionary for tag keys and values. Each distinct string is stored once and gets a dense
+     * 32-bit id. Lookups hash the raw bytes (farmhash), so interning a known string does not allocate.
+     */
+    class tag_dict {
+        mutable std::mutex mtx;
+        std::unordered_multimap<uint64_t, uint32_t> ids;
+        std::deque<std::string> strings; // by id, stable references
+
+    public:
+        uint32_t intern(const char *str, size_t len) {
+            auto h = ::util::Hash64(str, len);
+            std::lock_guard<std::mutex> lock(mtx);
+            auto range = ids.equal_range(h);
+            for (auto it = range.first; it != range.second; ++it) {
+                auto &s(strings[it->second]);
+                if (s.size() == len && std::memcmp(s.data(), str, len) == 0) return it->second;
+            }
+            auto id = static_cast<uint32_t>(strings.size());
+            strings.emplace_back(str, len);
+            ids.emplace(h, id);
+            return id;
+        }
+
+        uint32_t intern(const std::string &str) { return intern(str.data(), str.size()); }
+
+        const std::string &str(uint32_t id) const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return strings.at(id);
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return strings.size();
+        }
+
+        /**
+         * Sorts the (key, value) pairs of a tag set read in arbitrary order.
+         */
+        static void normalize(tag_ids &ids) {
+            auto n = ids.size() / 2;
+            std::vector<std::pair<uint32_t, uint32_t>> pairs(n);
+            for (size_t i = 0; i < n; ++i) pairs[i] = {ids[2 * i], ids[2 * i + 1]};
+            std::sort(pairs.begin(), pairs.end());
+            for (size_t i = 0; i < n; ++i) ids[2 * i] = pairs[i].first, ids[2 * i + 1] = pairs[i].second;
+        }
+
+        std::unordered_map<std::string, std::string> tags(const tag_ids &ids) const {
+            std::unordered_map<std::string, std::string> m;
+            std::lock_guard<std::mutex> lock(mtx);
+            for (size_t i = 0; i + 1 < ids.size(); i += 2) m.emplace(strings.at(ids[i]), strings.at(ids[i + 1]));
+            return m;
+        }
+    };
+}
@@ -0,0 +1,254 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/client.h"
+#include "../src/json-readers.h"
+#include "../src/json-stream.h"
+#include "../src/json-fast.h"
+#include "../src/csv-reader.h"
+#include "../src/fill.h"
+#include "../src/gorilla.h"
+
+/*
+ * Micro benchmarks, not part of the test suite. Build target influx_bench, run with an optional size factor:
+ *   ./influx_bench [scale]
+ */
+
+using namespace influxdb;
+
+static double scale = 1.0;
+
+template<class F>
+static double timeIt(F &&f, int reps = 5) {
+    double best = 1e9;
+    for (int i = 0; i < reps; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        best = std::min(best, dt);
+    }
+    return best;
+}
+
+static void report(const char *name, size_t bytes, double sec) {
+    std::printf("  %-40s %8.2f ms %8.1f MB/s\n", name, sec * 1e3, bytes / sec / 1e6);
+}
+
+static std::string makeJsonResponse(size_t rows, size_t cols) {
+    std::mt19937 rng{42};
+    std::uniform_real_distribution<float> dist(-1000.f, 1000.f);
+    std::string body = R"({"results":[{"statement_id":0,"series":[{"name":"bench","columns":["time")";
+    for (size_t c = 0; c < cols; ++c) body += ",\"f" + std::to_string(c) + "\"";
+    body += R"(],"values":[)";
+    int64_t t = 1529425346000;
+    char num[32];
+    for (size_t r = 0; r < rows; ++r) {
+        body += (r ? ",[" : "[") + std::to_string(t + 1000 * r);
+        for (size_t c = 0; c < cols; ++c) {
+            if (rng() % 50 == 0) body += ",null";
+            else {
+                std::snprintf(num, sizeof(num), ",%.7g", dist(rng));
+                body += num;
+            }
+        }
+        body += "]";
+    }
+    body += "]}]}]}";
+    return body;
+}
+
+// same rows as makeJsonResponse
+static std::string makeCsvResponse(size_t rows, size_t cols) {
+    std::mt19937 rng{42};
+    std::uniform_real_distribution<float> dist(-1000.f, 1000.f);
+    std::string body = "name,tags,time";
+    for (size_t c = 0; c < cols; ++c) body += ",f" + std::to_string(c);
+    body += "\n";
+    int64_t t = 1529425346000;
+    char num[32];
+    for (size_t r = 0; r < rows; ++r) {
+        body += "bench,," + std::to_string(t + 1000 * r);
+        for (size_t c = 0; c < cols; ++c) {
+            if (rng() % 50 == 0) body += ",";
+            else {
+                std::snprintf(num, sizeof(num), ",%.7g", dist(rng));
+                body += num;
+            }
+        }
+        body += "\n";
+    }
+    return body;
+}
+
+static void benchJsonReaders() {
+    constexpr size_t chunkSize = 16 * 1024;
+    for (size_t cols : {1, 4, 16}) {
+        auto rows = static_cast<size_t>(scale * 4e6 / (cols + 1));
+        auto body = makeJsonResponse(rows, cols);
+        std::printf("json /query response, %zu rows x %zu columns, %.1f MB\n", rows, cols, body.size() / 1e6);
+
+        report("ColumnReader + DataReader (2 passes)", body.size(), timeIt([&]() {
+            fetchResult r;
+            rapidjson::Reader reader;
+            ColumnReader colsReader;
+            rapidjson::StringStream ss0(body.c_str());
+            reader.Parse(ss0, colsReader);
+            DataReader dataReader{colsReader.columns.size(), r};
+            rapidjson::StringStream ss(body.c_str());
+            reader.Parse(ss, dataReader);
+        }));
+
+        report("json_stream<FetchReader> (chunked)", body.size(), timeIt([&]() {
+            fetchResult r;
+            FetchReader reader{r};
+            json_stream<FetchReader> stream{reader};
+            for (size_t i = 0; i < body.size(); i += chunkSize)
+                stream.feed(body.data() + i, std::min(chunkSize, body.size() - i));
+            stream.finish();
+        }));
+
+        report("FastFetchReader (chunked)", body.size(), timeIt([&]() {
+            fetchResult r;
+            FastFetchReader reader{r};
+            for (size_t i = 0; i < body.size(); i += chunkSize)
+                reader.feed(body.data() + i, std::min(chunkSize, body.size() - i));
+            reader.finish();
+        }));
+    }
+}
+
+static void benchCsvReader() {
+    constexpr size_t chunkSize = 16 * 1024;
+    for (size_t cols : {1, 4, 16}) {
+        auto rows = static_cast<size_t>(scale * 4e6 / (cols + 1));
+        auto json = makeJsonResponse(rows, cols), csv = makeCsvResponse(rows, cols);
+        std::printf("csv vs json /query response, %zu rows x %zu columns, json %.1f MB, csv %.1f MB (%.0f%%)\n",
+                    rows, cols, json.size() / 1e6, csv.size() / 1e6, 100. * csv.size() / json.size());
+
+        double sec = timeIt([&]() {
+            fetchResult r;
+            rapidjson::Reader reader;
+            DataReader dataReader{cols + 1, r};
+            rapidjson::StringStream ss(json.c_str());
+            reader.Parse(ss, dataReader);
+        });
+        report("json DataReader", json.size(), sec);
+        std::printf("  %-40s %8.1f Mrows/s\n", "", rows / sec / 1e6);
+
+        sec = timeIt([&]() {
+            fetchResult r;
+            CsvFetchReader reader{r};
+            for (size_t i = 0; i < csv.size(); i += chunkSize)
+                reader.feed(csv.data() + i, std::min(chunkSize, csv.size() - i));
+            reader.finish();
+        });
+        report("CsvFetchReader (chunked)", csv.size(), sec);
+        std::printf("  %-40s %8.1f Mrows/s\n", "", rows / sec / 1e6);
+    }
+}
+
+static void benchFillForward() {
+    std::mt19937 rng{42};
+    std::printf("fillForward, dispatch %s\n", fillForwardIsa());
+    for (unsigned nanPercent : {2, 30}) {
+        for (size_t stride : {1, 4, 16, 64}) {
+            auto rows = static_cast<size_t>(scale * 16e6 / stride);
+            std::vector<float> orig(rows * stride), d;
+            for (auto &v : orig) v = (rng() % 100 < nanPercent) ? NAN : static_cast<float>(rng() % 1000);
+
+            char name[64];
+            for (bool scalar : {true, false}) {
+                double best = 1e9;
+                for (int i = 0; i < 5; ++i) {
+                    d = orig;
+                    auto t0 = std::chrono::steady_clock::now();
+                    scalar ? fillForwardScalar(d.data(), rows, stride) : fillForward(d.data(), rows, stride);
+                    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+                }
+                std::snprintf(name, sizeof(name), "stride %2zu, %2u%% NaN, %s", stride, nanPercent,
+                              scalar ? "scalar" : fillForwardIsa());
+                report(name, d.size() * sizeof(float), best);
+            }
+        }
+    }
+}
+
+static void benchResample() {
+    std::mt19937 rng{42};
+    for (size_t stride : {1, 8}) {
+        influxdb::series s;
+        s.dataStride = stride;
+        s.num = static_cast<size_t>(scale * 16e6 / stride);
+        auto &time(s.getTimeVector());
+        time.resize(s.num);
+        for (size_t i = 0; i < s.num; ++i) time[i] = 1529425346000 + static_cast<int64_t>(i) * 1000;
+        s.data.resize(s.num * stride);
+        for (auto &v : s.data) v = static_cast<float>(rng() % 1000);
+
+        char name[64];
+        for (auto agg : {influxdb::aggregator::mean, influxdb::aggregator::max, influxdb::aggregator::last}) {
+            double best = 1e9;
+            for (int i = 0; i < 5; ++i) {
+                auto t0 = std::chrono::steady_clock::now();
+                auto r = s.resample(60000, agg);
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+            }
+            std::snprintf(name, sizeof(name), "resample 1m, stride %zu, agg %d", stride, static_cast<int>(agg));
+            report(name, s.data.size() * sizeof(float), best);
+        }
+    }
+}
+
+static void benchGorilla() {
+    std::mt19937 rng{42};
+    for (int noisy : {0, 1}) {
+        // sensor readings at 1s, 0.1 resolution, changing every few samples; or uniform noise
+        influxdb::series s;
+        s.dataStride = 4;
+        s.num = static_cast<size_t>(scale * 4e6);
+        auto &time(s.getTimeVector());
+        time.resize(s.num);
+        for (size_t i = 0; i < s.num; ++i) time[i] = 1529425346000 + static_cast<int64_t>(i) * 1000;
+        s.data.resize(s.num * s.dataStride);
+        std::vector<int> level(s.dataStride, 200);
+        for (size_t i = 0; i < s.num; ++i) {
+            for (size_t c = 0; c < s.dataStride; ++c) {
+                if (rng() % 4 == 0) level[c] += static_cast<int>(rng() % 3) - 1;
+                s.data[i * s.dataStride + c] = noisy ? static_cast<float>(rng() % 100000) / 7.f
+                                                     : static_cast<float>(level[c]) * 0.1f;
+            }
+        }
+
+        std::string enc;
+        auto encSec = timeIt([&]() {
+            enc.clear();
+            gorilla::encode(s, enc);
+        });
+        std::vector<int64_t> t(s.num);
+        std::vector<float> d(s.data.size());
+        auto decSec = timeIt([&]() {
+            gorilla::decode(enc.data(), enc.size(), s.num, s.dataStride, t.data(), d.data(), false);
+        });
+        if (t != time || d != s.data) std::printf("  gorilla: roundtrip mismatch\n");
+
+        auto raw = s.num * (sizeof(int64_t) + s.dataStride * sizeof(float));
+        std::printf("  gorilla %-32s %8.2f x  %6.2f bits/value\n", noisy ? "noise" : "sensor",
+                    static_cast<double>(raw) / enc.size(), enc.size() * 8.0 / s.data.size());
+        report(noisy ? "gorilla encode, noise" : "gorilla encode, sensor", raw, encSec);
+        report(noisy ? "gorilla decode, noise" : "gorilla decode, sensor", raw, decSec);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) scale = std::atof(argv[1]);
+    benchJsonReaders();
+    benchCsvReader();
+    benchFillForward();
+    benchResample();
+    benchGorilla();
+    return 0;
+}
@@ -0,0 +1,474 @@
+#include <cmath>
+#include <gtest/gtest.h>
+
+
+#include "../include/client.h"
+#include "../src/json-readers.h"
+#include "../src/json-stream.h"
+#include "../src/json-fast.h"
+#include "../src/msgpack-stream.h"
+#include "../src/csv-reader.h"
+#include "../src/chunked.h"
+
+
+static const std::string influxResponse = R"({"results":[{"statement_id":0,"series":[{"name":"load","columns":["time","v","n"],"values":[[1529425346000,null,0],[1529425348000,0.23,1],[1529425349000,0.26,1],[1529425350000,12,1],[1529425351000,1.5e-3,null]]}]}]})";
+
+
+TEST(InfluxDBJson, streamChunked) {
+    using namespace influxdb;
+
+    for (size_t chunkSize : {1, 2, 3, 7, 64, 4096}) {
+        fetchResult r;
+        DataReader dataReader{3, r};
+        json_stream<DataReader> stream{dataReader};
+        for (size_t i = 0; i < influxResponse.size(); i += chunkSize)
+            stream.feed(influxResponse.data() + i, std::min(chunkSize, influxResponse.size() - i));
+        stream.finish();
+
+        ASSERT_EQ(r.timeVector().size(), 5);
+        ASSERT_EQ(r.data.size(), 10);
+        ASSERT_EQ(r.t(0), 1529425346000);
+        ASSERT_EQ(r.t(4), 1529425351000);
+        ASSERT_TRUE(std::isnan(r.data[0]));
+        ASSERT_EQ(r.data[1], 0);
+        ASSERT_NEAR(r.data[2], 0.23, 1e-7);
+        ASSERT_NEAR(r.data[6], 12, 1e-7);
+        ASSERT_NEAR(r.data[8], 1.5e-3, 1e-7);
+        ASSERT_EQ(r.data[9], r.data[7]); // null repeats previous
+    }
+}
+
+
+TEST(InfluxDBJson, streamColumns) {
+    using namespace influxdb;
+
+    ColumnReader colsReader;
+    json_stream<ColumnReader> stream{colsReader};
+    stream.feed(influxResponse.data(), 80);
+    ASSERT_FALSE(stream.complete());
+    stream.feed(influxResponse.data() + 80, 20);
+    ASSERT_TRUE(stream.complete());
+    stream.finish();
+
+    ASSERT_EQ(colsReader.columns.size(), 3);
+    ASSERT_EQ(colsReader.columns[2], "n");
+}
+
+
+TEST(InfluxDBJson, streamTruncated) {
+    using namespace influxdb;
+
+    fetchResult r;
+    DataReader dataReader{3, r};
+    json_stream<DataReader> stream{dataReader};
+    stream.feed(influxResponse.data(), influxResponse.size() / 2);
+    ASSERT_THROW(stream.finish(), std::runtime_error);
+}
+
+
+TEST(InfluxDBJson, fetchReaderSinglePass) {
+    using namespace influxdb;
+
+    fetchResult r;
+    FetchReader reader{r};
+    json_stream<FetchReader> stream{reader};
+    for (size_t i = 0; i < influxResponse.size(); i += 5)
+        stream.feed(influxResponse.data() + i, std::min<size_t>(5, influxResponse.size() - i));
+    stream.finish();
+
+    ASSERT_EQ(r.columns, (std::vector<std::string>{"time", "v", "n"}));
+    ASSERT_EQ(r.timeVector().size(), 5);
+    ASSERT_EQ(r.data.size(), 10);
+    ASSERT_TRUE(std::isnan(r.data[0]));
+    ASSERT_NEAR(r.data[2], 0.23, 1e-7);
+    ASSERT_EQ(r.data[9], r.data[7]);
+}
+
+
+TEST(InfluxDBJson, seriesReaderSinglePass) {
+    using namespace influxdb;
+
+    std::string body = R"({"results":[{"statement_id":0,"series":[)"
+                       R"({"name":"load","tags":{"host":"a"},"columns":["time","v"],"values":[[1,1],[2,null]]},)"
+                       R"({"name":"load","tags":{"host":"b"},"columns":["time","v"],"values":[[1,null],[2,3]]}]}]})";
+    std::vector<series> batch;
+    tag_dict dict;
+    SeriesReader reader{batch, &dict};
+    json_stream<SeriesReader> stream{reader};
+    stream.feed(body.data(), body.size());
+    stream.finish();
+
+    ASSERT_EQ(batch.size(), 2);
+    for (auto &s : batch) ASSERT_EQ(s.columns, (std::vector<std::string>{"time", "v"}));
+    ASSERT_EQ(batch[0].data, (std::vector<float>{1, 1})); // null repeats previous
+    ASSERT_TRUE(std::isnan(batch[1].data[0]));
+    ASSERT_EQ(dict.tags(batch[1].tagIds).at("host"), "b");
+}
+
+
+TEST(InfluxDBJson, fastReader) {
+    using namespace influxdb;
+
+    for (size_t chunkSize : {1, 2, 3, 7, 64, 4096}) {
+        fetchResult r;
+        FastFetchReader reader{r};
+        for (size_t i = 0; i < influxResponse.size(); i += chunkSize)
+            reader.feed(influxResponse.data() + i, std::min(chunkSize, influxResponse.size() - i));
+        reader.finish();
+
+        ASSERT_FALSE(reader.usedFallback());
+        ASSERT_EQ(r.columns, (std::vector<std::string>{"time", "v", "n"}));
+        ASSERT_EQ(r.timeVector().size(), 5);
+        ASSERT_EQ(r.data.size(), 10);
+        ASSERT_EQ(r.t(0), 1529425346000);
+        ASSERT_EQ(r.t(4), 1529425351000);
+        ASSERT_TRUE(std::isnan(r.data[0]));
+        ASSERT_EQ(r.data[1], 0);
+        ASSERT_NEAR(r.data[2], 0.23, 1e-7);
+        ASSERT_NEAR(r.data[6], 12, 1e-7);
+        ASSERT_NEAR(r.data[8], 1.5e-3, 1e-7);
+        ASSERT_EQ(r.data[9], r.data[7]);
+    }
+}
+
+
+TEST(InfluxDBJson, fastReaderNumbers) {
+    using namespace influxdb;
+
+    std::vector<std::string> nums{"0", "-0.0", "0.1", "0.23", "-2.5e-7", "1E+3", "123456.789", "0.000001234",
+                                  "3.4028234e38", "12345678901234567890123", "0.30000000000000004",
+                                  "-1.7976931348623157e-300", "9007199254740993"};
+    std::string body = R"({"results":[{"statement_id":0,"series":[{"name":"m","columns":["time","v"],"values":[)";
+    for (size_t i = 0; i < nums.size(); ++i) body += (i ? ",[" : "[") + std::to_string(i) + "," + nums[i] + "]";
+    body += "]}]}]}";
+
+    fetchResult r;
+    FastFetchReader reader{r};
+    reader.feed(body.data(), body.size());
+    reader.finish();
+
+    ASSERT_FALSE(reader.usedFallback());
+    ASSERT_EQ(r.data.size(), nums.size());
+    for (size_t i = 0; i < nums.size(); ++i) {
+        EXPECT_EQ(r.data[i], static_cast<float>(std::strtod(nums[i].c_str(), nullptr))) << nums[i];
+    }
+}
+
+
+TEST(InfluxDBJson, fastReaderFallback) {
+    using namespace influxdb;
+
+    {
+        fetchResult r;
+        FastFetchReader reader{r};
+        std::string body = R"({"results":[{"statement_id":0,"series":[{"name":"m","columns":["time","v\"x"],"values":[[1,2]]}]}]})";
+        reader.feed(body.data(), body.size());
+        reader.finish();
+        ASSERT_TRUE(reader.usedFallback());
+        ASSERT_EQ(r.columns[1], "v\"x");
+        ASSERT_EQ(r.data.size(), 1);
+        ASSERT_EQ(r.data[0], 2);
+    }
+
+    {
+        fetchResult r;
+        FastFetchReader reader{r};
+        std::string body = R"({"results":[{"statement_id":0}]})";
+        reader.feed(body.data(), body.size());
+        reader.finish();
+        ASSERT_TRUE(reader.usedFallback());
+        ASSERT_TRUE(r.columns.empty());
+    }
+
+    {
+        fetchResult r;
+        FastFetchReader reader{r};
+        reader.feed(influxResponse.data(), influxResponse.size() - 10);
+        ASSERT_THROW(reader.finish(), std::runtime_error);
+    }
+
+    // whitespace between rows stays on the fast path, a row outside the fast grammar hands the rest to FetchReader
+    std::string spaced = R"({"results":[{"statement_id":0,"series":[{"name":"m","columns":["time","v"],"values":[ [1,2],)"
+                         "\n" R"( [2,null] ]}]}]})";
+    std::string inRow = R"({"results":[{"statement_id":0,"series":[{"name":"m","columns":["time","v"],"values":[[1,2],[2,null],[3, 4],[4,5]]}]}]})";
+    for (size_t chunkSize : {1, 3, 7, 4096}) {
+        auto read = [chunkSize](const std::string &body, fetchResult &r) {
+            FastFetchReader reader{r};
+            for (size_t i = 0; i < body.size(); i += chunkSize)
+                reader.feed(body.data() + i, std::min(chunkSize, body.size() - i));
+            reader.finish();
+            return reader.usedFallback();
+        };
+
+        fetchResult r;
+        ASSERT_FALSE(read(spaced, r));
+        ASSERT_EQ(r.timeVector(), (std::vector<int64_t>{1, 2}));
+        ASSERT_EQ(r.data, (std::vector<float>{2, 2}));
+
+        fetchResult f;
+        ASSERT_TRUE(read(inRow, f));
+        ASSERT_EQ(f.columns, (std::vector<std::string>{"time", "v"}));
+        ASSERT_EQ(f.timeVector(), (std::vector<int64_t>{1, 2, 3, 4}));
+        ASSERT_EQ(f.data, (std::vector<float>{2, 2, 4, 5}));
+    }
+}
+
+
+TEST(InfluxDBJson, chunkedResponse) {
+    using namespace influxdb;
+
+    // chunked=true&chunk_size=3
+    std::string body = R"({"results":[{"statement_id":0,"series":[{"name":"load","columns":["time","v","n"],"values":[[1529425346000,null,0],[1529425348000,0.23,1],[1529425349000,0.26,1]],"partial":true}],"partial":true}]})"
+                       "\n"
+                       R"({"results":[{"statement_id":0,"series":[{"name":"load","columns":["time","v","n"],"values":[[1529425350000,12,1],[1529425351000,1.5e-3,null]]}]}]})"
+                       "\n";
+
+    for (size_t chunkSize : {1, 3, 7, 64, 4096}) {
+        fetchResult r;
+        chunked_json_reader<FastFetchReader> reader{r};
+        for (size_t i = 0; i < body.size(); i += chunkSize)
+            reader.feed(body.data() + i, std::min(chunkSize, body.size() - i));
+        reader.finish();
+
+        ASSERT_EQ(r.columns, (std::vector<std::string>{"time", "v", "n"}));
+        ASSERT_EQ(r.timeVector().size(), 5);
+        ASSERT_EQ(r.data.size(), 10);
+        ASSERT_EQ(r.t(2), 1529425349000);
+        ASSERT_EQ(r.t(3), 1529425350000);
+        ASSERT_NEAR(r.data[6], 12, 1e-7);
+        ASSERT_EQ(r.data[9], r.data[7]); // null repeats previous across chunks
+    }
+
+    fetchResult r;
+    chunked_json_reader<FastFetchReader> reader{r};
+    std::string other = R"({"results":[{"statement_id":0,"series":[{"name":"load","columns":["time","x"],"values":[[1,2]]}]}]})";
+    reader.feed(body.data(), body.size());
+    reader.feed(other.data(), other.size());
+    ASSERT_THROW(reader.finish(), std::runtime_error);
+}
+
+static const std::string influxCsvResponse = "name,tags,time,v,n\n"
+                                             "load,,1529425346000,,0\n"
+                                             "load,,1529425348000,0.23,1\n"
+                                             "load,,1529425349000,0.26,1\n"
+                                             "load,,1529425350000,12,1\n"
+                                             "load,,1529425351000,1.5e-3,\n";
+
+
+TEST(InfluxDBCsv, fetchReader) {
+    using namespace influxdb;
+
+    for (size_t chunkSize : {1, 2, 3, 7, 17, 64, 4096}) {
+        fetchResult r;
+        CsvFetchReader reader{r};
+        for (size_t i = 0; i < influxCsvResponse.size(); i += chunkSize)
+            reader.feed(influxCsvResponse.data() + i, std::min(chunkSize, influxCsvResponse.size() - i));
+        reader.finish();
+
+        ASSERT_EQ(r.columns, (std::vector<std::string>{"time", "v", "n"}));
+        ASSERT_EQ(r.timeVector().size(), 5);
+        ASSERT_EQ(r.data.size(), 10);
+        ASSERT_EQ(r.t(0), 1529425346000);
+        ASSERT_EQ(r.t(4), 1529425351000);
+        ASSERT_TRUE(std::isnan(r.data[0]));
+        ASSERT_EQ(r.data[1], 0);
+        ASSERT_NEAR(r.data[2], 0.23, 1e-7);
+        ASSERT_NEAR(r.data[6], 12, 1e-7);
+        ASSERT_NEAR(r.data[8], 1.5e-3, 1e-7);
+        ASSERT_EQ(r.data[9], r.data[7]);
+    }
+}
+
+
+TEST(InfluxDBCsv, fetchReaderShapes) {
+    using namespace influxdb;
+
+    {
+        // CRLF, quoted tags, no final newline, stops at the next series
+        fetchResult r;
+        CsvFetchReader reader{r};
+        std::string body = "name,tags,time,v\r\n"
+                           "m,\"host=a,region=\"\"x\"\"\",1,2.5\r\n"
+                           "m,\"host=a,region=\"\"x\"\"\",2,3\r\n"
+                           "m,\"host=b,region=\"\"x\"\"\",3,4\r\n"
+                           "m,\"host=a,region=\"\"x\"\"\",4,5";
+        reader.feed(body.data(), body.size());
+        reader.finish();
+        ASSERT_EQ(r.columns, (std::vector<std::string>{"time", "v"}));
+        ASSERT_EQ(r.timeVector(), (std::vector<int64_t>{1, 2}));
+        ASSERT_EQ(r.data, (std::vector<float>{2.5f, 3.f}));
+    }
+
+    {
+        fetchResult r;
+        CsvFetchReader reader{r};
+        reader.finish();
+        ASSERT_TRUE(r.columns.empty());
+    }
+
+    {
+        fetchResult r;
+        CsvFetchReader reader{r};
+        std::string body = "name,tags,time,v\nm,,1,2,3\n";
+        ASSERT_THROW(reader.feed(body.data(), body.size()), std::runtime_error);
+    }
+
+    {
+        fetchResult r;
+        CsvFetchReader reader{r};
+        std::string body = "error\nretention policy not found\n";
+        ASSERT_THROW(reader.feed(body.data(), body.size()), std::runtime_error);
+    }
+}
+
+
+namespace mp {
+    static void be(std::string &s, uint64_t v, int n) {
+        for (int i = n - 1; i >= 0; --i) s.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+    }
+
+    static std::string str(const std::string &v) { return std::string(1, static_cast<char>(0xa0 | v.size())) + v; }
+
+    static std::string map(size_t n) { return std::string(1, static_cast<char>(0x80 | n)); }
+
+    static std::string arr(size_t n) {
+        std::string s(1, static_cast<char>(0xdc));
+        be(s, n, 2);
+        return s;
+    }
+
+    static std::string i64(int64_t v) {
+        std::string s(1, static_cast<char>(0xd3));
+        be(s, static_cast<uint64_t>(v), 8);
+        return s;
+    }
+
+    static std::string f64(double v) {
+        std::string s(1, static_cast<char>(0xcb));
+        uint64_t u;
+        std::memcpy(&u, &v, 8);
+        be(s, u, 8);
+        return s;
+    }
+
+    static const std::string nil(1, static_cast<char>(0xc0));
+
+    // ext 8 of `type` with seconds and nanoseconds in the layout of the type (5: msgp time, -1: msgpack timestamp)
+    static std::string time(int8_t type, int64_t sec, uint32_t nsec) {
+        std::string s{static_cast<char>(0xc7), 12, static_cast<char>(type)};
+        if (type == 5) {
+            be(s, static_cast<uint64_t>(sec), 8);
+            be(s, nsec, 4);
+        } else {
+            be(s, nsec, 4);
+            be(s, static_cast<uint64_t>(sec), 8);
+        }
+        return s;
+    }
+}
+
+
+TEST(InfluxDBMsgpack, fetchReader) {
+    using namespace influxdb;
+
+    // same content as influxResponse, encoded like influxdb's msgpack response writer
+    std::string body = mp::map(1) + mp::str("results") + mp::arr(1) +
+                       mp::map(2) + mp::str("statement_id") + mp::i64(0) + mp::str("series") + mp::arr(1) +
+                       mp::map(3) + mp::str("name") + mp::str("load") +
+                       mp::str("columns") + mp::arr(3) + mp::str("time") + mp::str("v") + mp::str("n") +
+                       mp::str("values") + mp::arr(5) +
+                       mp::arr(3) + mp::i64(1529425346000) + mp::nil + mp::i64(0) +
+                       mp::arr(3) + mp::i64(1529425348000) + mp::f64(0.23) + mp::i64(1) +
+                       mp::arr(3) + mp::i64(1529425349000) + mp::f64(0.26) + mp::i64(1) +
+                       mp::arr(3) + mp::i64(1529425350000) + mp::f64(12) + mp::i64(1) +
+                       mp::arr(3) + mp::i64(1529425351000) + mp::f64(1.5e-3) + mp::nil;
+
+    for (size_t chunkSize : {1, 3, 16, 4096}) {
+        fetchResult r;
+        FetchReader reader{r};
+        msgpack_stream<FetchReader> stream{reader};
+        for (size_t i = 0; i < body.size(); i += chunkSize)
+            stream.feed(body.data() + i, std::min(chunkSize, body.size() - i));
+        stream.finish();
+
+        ASSERT_EQ(r.columns, (std::vector<std::string>{"time", "v", "n"}));
+        ASSERT_EQ(r.timeVector().size(), 5);
+        ASSERT_EQ(r.data.size(), 10);
+        ASSERT_EQ(r.t(0), 1529425346000);
+        ASSERT_EQ(r.t(4), 1529425351000);
+        ASSERT_TRUE(std::isnan(r.data[0]));
+        ASSERT_EQ(r.data[1], 0);
+        ASSERT_EQ(r.data[2], 0.23f);
+        ASSERT_EQ(r.data[6], 12.f);
+        ASSERT_EQ(r.data[8], 1.5e-3f);
+        ASSERT_EQ(r.data[9], r.data[7]);
+    }
+
+    fetchResult r;
+    FetchReader reader{r};
+    msgpack_stream<FetchReader> stream{reader};
+    stream.feed(body.data(), body.size() / 2);
+    ASSERT_THROW(stream.finish(), std::runtime_error);
+}
+
+
+TEST(InfluxDBMsgpack, timeExtension) {
+    using namespace influxdb;
+
+    // without epoch=ms, influxdb encodes time with its own ext type 5
+    std::string body = mp::map(1) + mp::str("results") + mp::arr(1) +
+                       mp::map(2) + mp::str("statement_id") + mp::i64(0) + mp::str("series") + mp::arr(1) +
+                       mp::map(3) + mp::str("name") + mp::str("load") +
+                       mp::str("columns") + mp::arr(2) + mp::str("time") + mp::str("v") +
+                       mp::str("values") + mp::arr(3) +
+                       mp::arr(2) + mp::time(5, 1529425346, 0) + mp::f64(1) +
+                       mp::arr(2) + mp::time(5, 1529425347, 250000000) + mp::f64(2) +
+                       mp::arr(2) + mp::time(-1, 1529425348, 999999999) + mp::f64(3);
+
+    for (size_t chunkSize : {1, 7, 4096}) {
+        fetchResult r;
+        FetchReader reader{r};
+        msgpack_stream<FetchReader> stream{reader};
+        for (size_t i = 0; i < body.size(); i += chunkSize)
+            stream.feed(body.data() + i, std::min(chunkSize, body.size() - i));
+        stream.finish();
+
+        ASSERT_EQ(r.timeVector(), (std::vector<int64_t>{1529425346000, 1529425347250, 1529425348999}));
+        ASSERT_EQ(r.data, (std::vector<float>{1, 2, 3}));
+    }
+
+    std::string unknown = mp::time(7, 0, 0);
+    fetchResult r;
+    FetchReader reader{r};
+    msgpack_stream<FetchReader> stream{reader};
+    ASSERT_THROW(stream.feed(unknown.data(), unknown.size()), std::runtime_error);
+}
+
+
+TEST(InfluxDBMsgpack, chunkedResponse) {
+    using namespace influxdb;
+
+    auto chunk = [](std::vector<std::pair<int64_t, double>> rows) {
+        std::string s = mp::map(1) + mp::str("results") + mp::arr(1) +
+                        mp::map(2) + mp::str("statement_id") + mp::i64(0) + mp::str("series") + mp::arr(1) +
+                        mp::map(3) + mp::str("name") + mp::str("load") +
+                        mp::str("columns") + mp::arr(2) + mp::str("time") + mp::str("v") +
+                        mp::str("values") + mp::arr(rows.size());
+        for (auto &row : rows) s += mp::arr(2) + mp::i64(row.first) + mp::f64(row.second);
+        return s;
+    };
+    std::string body = chunk({{1529425346000, 1.5}, {1529425347000, 2.5}}) + chunk({{1529425348000, 3.5}});
+
+    for (size_t chunkSize : {1, 5, 4096}) {
+        fetchResult r;
+        FetchReader reader{r};
+        documents_filter<FetchReader> filter{reader};
+        msgpack_stream<documents_filter<FetchReader>> stream{filter};
+        for (size_t i = 0; i < body.size(); i += chunkSize)
+            stream.feed(body.data() + i, std::min(chunkSize, body.size() - i));
+        stream.finish();
+
+        ASSERT_EQ(r.timeVector(), (std::vector<int64_t>{1529425346000, 1529425347000, 1529425348000}));
+        ASSERT_EQ(r.data, (std::vector<float>{1.5f, 2.5f, 3.5f}));
+    }
+}
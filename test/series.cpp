@@ -1,9 +1,22 @@
 #include <cmath>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <gtest/gtest.h>
 
 
 #include "../include/client.h"
 #include "../src/util.h"
+#include "../src/admission.h"
+#include "../src/retry.h"
+#include "../src/fill.h"
+#include "../src/rolling.h"
+#include "../src/tag-dict.h"
+#include "../src/cache.h"
+#include "../src/mapped-series.h"
+#include "../src/gorilla.h"
 
 
 /*
@@ -29,6 +42,31 @@ load,host=s01,region=us v=0.18 1529425353000000000'
  */
 
 
+/**
+ * A row-major series, `columns` starts with "time" and `data` holds one value per column but time per row.
+ */
+static influxdb::series
+makeSeries(std::vector<std::string> columns, std::vector<int64_t> time, std::vector<float> data) {
+    influxdb::series s;
+    s.dataStride = columns.size() - 1;
+    s.columns = std::move(columns);
+    s.num = time.size();
+    s.getTimeVector() = std::move(time);
+    s.data = std::move(data);
+    s.checkNum();
+    return s;
+}
+
+/**
+ * 0, 1, 2, ... as values of a single column series.
+ */
+static std::vector<float> rowNumbers(size_t n) {
+    std::vector<float> v(n);
+    for (size_t i = 0; i < n; ++i) v[i] = static_cast<float>(i);
+    return v;
+}
+
+
 TEST(InfluxDB, fetch) {
     using namespace influxdb;
     using namespace influxdb::util;
@@ -60,6 +98,31 @@ TEST(InfluxDB, fetch) {
 }
 
 
+TEST(InfluxDB, fetchGroups) {
+    using namespace influxdb;
+    using namespace std::chrono_literals;
+
+    client c("localhost", 8086, "test", 4s); // several batches
+    auto groups = c.fetchGroups(
+            "SELECT last(v) as v FROM load WHERE :time_condition: GROUP BY time(1s), * FILL(previous)",
+            {"2018-06-19T16:22:26Z", "2018-06-19T16:22:40Z"}, {},
+            [](const std::unordered_map<std::string, std::string> &tags) {
+                std::string key;
+                for (auto &kv : std::map<std::string, std::string>(tags.begin(), tags.end()))
+                    key += kv.first + "=" + kv.second + ",";
+                return key;
+            });
+
+    ASSERT_FALSE(groups.empty());
+    for (auto &kv : groups) {
+        auto &s(kv.second);
+        s.checkNum();
+        ASSERT_EQ(s.columns[1], "v");
+        ASSERT_GT(s.num, 1);
+        for (size_t i = 1; i < s.num; ++i) ASSERT_LT(s.t(i - 1), s.t(i));
+    }
+}
+
 TEST(InfluxDB, join) {
     using namespace influxdb;
     using namespace influxdb::util;
@@ -176,6 +239,885 @@ TEST(InfluxDBSeries, fill2) {
 }
 
 
+TEST(InfluxDBSeries, fillTimeGapsModes) {
+    using namespace influxdb;
+
+    const auto input = makeSeries({"time", "a", "b"}, {100, 200, 500, 600, 800},
+                                  {0.f, 10.f,
+                                   1.f, 20.f,
+                                   // 2 sample gap
+                                   4.f, 50.f,
+                                   5.f, 60.f,
+                                   // 1 sample gap
+                                   7.f, 80.f});
+
+    auto s0 = input;
+    ASSERT_EQ(s0.fillTimeGaps(fill_mode::linear), 3);
+    s0.checkNum();
+    ASSERT_EQ(s0.timeVector(), (std::vector<int64_t>{100, 200, 300, 400, 500, 600, 700, 800}));
+    ASSERT_EQ(s0.data, (std::vector<float>{0, 10, 1, 20, 2, 30, 3, 40, 4, 50, 5, 60, 6, 70, 7, 80}));
+
+    auto s1 = input;
+    ASSERT_EQ(s1.fillTimeGaps(fill_mode::constant, -1.f), 3);
+    ASSERT_EQ(s1.data, (std::vector<float>{0, 10, 1, 20, -1, -1, -1, -1, 4, 50, 5, 60, -1, -1, 7, 80}));
+
+    auto s2 = input;
+    ASSERT_EQ(s2.fillTimeGaps(), 3);
+    ASSERT_EQ(s2.data, (std::vector<float>{0, 10, 1, 20, 1, 20, 1, 20, 4, 50, 5, 60, 5, 60, 7, 80}));
+    ASSERT_EQ(s2.fillTimeGaps(), 0);
+}
+
+
+TEST(InfluxDBSeries, fillForward) {
+    using namespace influxdb;
+
+    std::mt19937 rng{1};
+    for (size_t stride : {1, 2, 3, 4, 5, 7, 8, 9, 16, 17, 64}) {
+        for (unsigned nanPercent : {2, 50, 100}) {
+            size_t rows = 97;
+            std::vector<float> a(rows * stride);
+            for (auto &v : a) v = (rng() % 100 < nanPercent) ? NAN : static_cast<float>(rng() % 1000);
+            auto b = a;
+
+            auto n = fillForward(a.data(), rows, stride);
+            ASSERT_EQ(n, fillForwardScalar(b.data(), rows, stride)) << stride << " " << fillForwardIsa();
+            for (size_t i = 0; i < a.size(); ++i) {
+                if (std::isnan(b[i])) ASSERT_TRUE(std::isnan(a[i]));
+                else ASSERT_EQ(a[i], b[i]) << stride << " " << i;
+            }
+            for (size_t i = stride; i < a.size(); ++i) {
+                if (std::isnan(a[i])) ASSERT_TRUE(std::isnan(a[i - stride]));
+            }
+        }
+    }
+}
+
+
+TEST(InfluxDBSeries, compactTime) {
+    using namespace influxdb;
+
+    std::vector<int64_t> regular;
+    for (int64_t i = 0; i < 40; ++i) regular.push_back(1000 + i * 10);
+    regular[20] = 1203; // off the grid
+
+    auto s = makeSeries({"time", "v"}, regular, rowNumbers(regular.size()));
+    ASSERT_TRUE(s.compactTime());
+    ASSERT_TRUE(s.tIsCompact());
+    ASSERT_EQ(s.tStep(), 10);
+    ASSERT_EQ(s.tSize(), 40);
+    s.checkNum();
+    for (size_t i = 0; i < s.num; ++i) ASSERT_EQ(s.t(i), regular[i]);
+
+    // reading the time vector keeps time compact
+    const series &cs(s);
+    ASSERT_EQ(cs.getTimeVector(), regular);
+    ASSERT_EQ(s.timeVector(), regular);
+    ASSERT_TRUE(s.tIsCompact());
+
+    // erase at the ends keeps time compact
+    s.erase(0, 5);
+    s.erase(30);
+    ASSERT_TRUE(s.tIsCompact());
+    ASSERT_EQ(s.num, 30);
+    ASSERT_EQ(s.t(0), 1050);
+    ASSERT_EQ(s.t(15), 1203);
+    ASSERT_EQ(s.t(16), 1210);
+    ASSERT_EQ(s.tEnd(), 1340);
+    ASSERT_EQ(s.data[0], 5.f);
+    ASSERT_EQ(s.timeVector().size(), 30);
+    ASSERT_EQ(s.timeVector()[15], 1203);
+
+    // appending (after a gap)
+    std::vector<int64_t> next;
+    for (int64_t i = 0; i < 20; ++i) next.push_back(1370 + i * 10);
+    auto s2 = makeSeries({"time", "v"}, next, rowNumbers(next.size()));
+    ASSERT_TRUE(s2.compactTime());
+    s.append(std::move(s2));
+    ASSERT_TRUE(s.tIsCompact());
+    ASSERT_EQ(s.num, 50);
+    ASSERT_EQ(s.t(29), 1340);
+    ASSERT_EQ(s.t(30), 1370);
+    ASSERT_EQ(s.tEnd(), 1560);
+    s.checkNum();
+
+    // erase in the middle expands
+    s.erase(10, 1);
+    ASSERT_FALSE(s.tIsCompact());
+    ASSERT_EQ(s.t(10), 1160);
+    ASSERT_EQ(s.timeVector().size(), s.num);
+
+    // irregular
+    auto s3 = makeSeries({"time", "v"}, {1, 2, 4, 8, 16, 32}, rowNumbers(6));
+    ASSERT_FALSE(s3.compactTime());
+
+    // gaps of a compact series
+    std::vector<int64_t> gappy;
+    for (int64_t i = 0; i < 40; ++i) gappy.push_back(i * 10 + (i >= 30 ? 20 : 0));
+    auto s4 = makeSeries({"time", "v"}, gappy, rowNumbers(gappy.size()));
+    ASSERT_TRUE(s4.compactTime());
+    ASSERT_EQ(s4.t(29), 290);
+    ASSERT_EQ(s4.t(30), 320);
+    ASSERT_EQ(s4.fillTimeGaps(), 2);
+    ASSERT_TRUE(s4.tIsCompact());
+    ASSERT_EQ(s4.num, 42);
+    ASSERT_EQ(s4.tEnd(), 410);
+    for (size_t i = 0; i < s4.num; ++i) ASSERT_EQ(s4.t(i), static_cast<int64_t>(i) * 10);
+    s4.checkNum();
+}
+
+
+TEST(InfluxDBSeries, columnar) {
+    using namespace influxdb;
+
+    const auto input = makeSeries({"time", "a", "b", "c"}, {100, 200, 300, 400, 600, 700},
+                                  {NAN, 1, 2,
+                                   3, NAN, 5,
+                                   6, 7, 8,
+                                   9, NAN, 11,
+                                   12, 13, 14,
+                                   NAN, 16, 17});
+
+    auto expectEqual = [](const series &a, const series &b) {
+        ASSERT_EQ(a.num, b.num);
+        ASSERT_EQ(a.dataStride, b.dataStride);
+        for (size_t r = 0; r < a.num; ++r) {
+            ASSERT_EQ(a.t(r), b.t(r));
+            for (size_t c = 0; c < a.dataStride; ++c) {
+                if (std::isnan(a.at(r, c))) ASSERT_TRUE(std::isnan(b.at(r, c)));
+                else ASSERT_EQ(a.at(r, c), b.at(r, c)) << r << " " << c;
+            }
+        }
+    };
+
+    auto rows = input, cols = input;
+    cols.toColumnar();
+    ASSERT_TRUE(cols.isColumnar());
+    ASSERT_TRUE(cols.column(1).contiguous());
+    ASSERT_EQ(cols.column(1).ptr, cols.data.data() + 6);
+    ASSERT_EQ(cols.column(2)[4], 14.f);
+    ASSERT_EQ(rows.column(2)[4], 14.f);
+    expectEqual(rows, cols);
+
+    ASSERT_EQ(rows.fill(), cols.fill());
+    ASSERT_TRUE(cols.isColumnar());
+    expectEqual(rows, cols);
+
+    ASSERT_EQ(rows.trim(), cols.trim());
+    expectEqual(rows, cols);
+
+    auto other = input;
+    other.columns = {"time", "x", "y", "z"};
+    other.fill();
+    rows.joinInner(other);
+    other.toColumnar();
+    cols.joinInner(other);
+    ASSERT_EQ(cols.dataStride, 6);
+    expectEqual(rows, cols);
+
+    rows.erase(2, 2);
+    cols.erase(2, 2);
+    expectEqual(rows, cols);
+
+    std::stringstream ss;
+    ss << cols;
+    series read;
+    ss >> read;
+    ASSERT_TRUE(read.isColumnar()); // the binary format keeps the layout
+    expectEqual(rows, read);
+
+    cols.toRowMajor();
+    ASSERT_EQ(cols.data, rows.data);
+}
+
+
+TEST(InfluxDBSeries, join) {
+    using namespace influxdb;
+
+    auto a = makeSeries({"time", "a"}, {100, 200, 300, 400, 500}, {1, 2, 3, 4, 5});
+    auto b = makeSeries({"time", "b"}, {200, 300, 500, 600}, {20, 30, 50, 60});
+    auto c = makeSeries({"time", "c"}, {90, 190, 300, 480}, {9, 19, 30, 48});
+    c.toColumnar();
+
+    auto inner = series::join({a, b, c}, join_mode::inner);
+    inner.checkNum();
+    ASSERT_EQ(inner.columns, (std::vector<std::string>{"time", "a", "b", "c"}));
+    ASSERT_EQ(inner.timeVector(), (std::vector<int64_t>{300}));
+    ASSERT_EQ(inner.data, (std::vector<float>{3, 30, 30}));
+
+    auto ab = series::join({a, b}, join_mode::inner);
+    ASSERT_EQ(ab.timeVector(), (std::vector<int64_t>{200, 300, 500}));
+    ASSERT_EQ(ab.data, (std::vector<float>{2, 20, 3, 30, 5, 50}));
+
+    auto left = series::join({a, b}, join_mode::leftOuter);
+    ASSERT_EQ(left.num, 5);
+    ASSERT_TRUE(std::isnan(left.data[1]));
+    ASSERT_EQ(left.data[3], 20);
+    ASSERT_TRUE(std::isnan(left.data[7]));
+
+    auto asOf = series::join({a, b, c}, join_mode::asOf, 15);
+    ASSERT_EQ(asOf.timeVector(), a.timeVector());
+    // row 100: c from 90
+    ASSERT_TRUE(std::isnan(asOf.data[1]));
+    ASSERT_EQ(asOf.data[2], 9);
+    // row 200: b exact, c from 190
+    ASSERT_EQ(asOf.data[4], 20);
+    ASSERT_EQ(asOf.data[5], 19);
+    // row 400: b from 300 is too old, c too
+    ASSERT_TRUE(std::isnan(asOf.data[10]));
+    ASSERT_TRUE(std::isnan(asOf.data[11]));
+    // row 500: c from 480 is too old
+    ASSERT_EQ(asOf.data[13], 50);
+    ASSERT_TRUE(std::isnan(asOf.data[14]));
+}
+
+
+TEST(InfluxDBSeries, resample) {
+    using namespace influxdb;
+
+    series s;
+    s.columns = {"time", "a", "b"};
+    s.dataStride = 2;
+    s.getTimeVector() = {-5, 0, 3, 7, 10, 25, 29};
+    s.data = {1, 10, 2, NAN, 3, 30, 4, 40, 5, 50, 6, 60, 7, NAN};
+    s.num = 7;
+
+    auto mean = s.resample(10, aggregator::mean);
+    mean.checkNum();
+    ASSERT_EQ(mean.columns, s.columns);
+    ASSERT_EQ(mean.timeVector(), (std::vector<int64_t>{-10, 0, 10, 20}));
+    ASSERT_EQ(mean.data, (std::vector<float>{1, 10, 3, 35, 5, 50, 6.5, 60}));
+
+    ASSERT_EQ(s.resample(10, aggregator::min).data, (std::vector<float>{1, 10, 2, 30, 5, 50, 6, 60}));
+    ASSERT_EQ(s.resample(10, aggregator::max).data, (std::vector<float>{1, 10, 4, 40, 5, 50, 7, 60}));
+    ASSERT_EQ(s.resample(10, aggregator::sum).data, (std::vector<float>{1, 10, 9, 70, 5, 50, 13, 60}));
+    ASSERT_EQ(s.resample(10, aggregator::count).data, (std::vector<float>{1, 1, 3, 2, 1, 1, 2, 1}));
+    ASSERT_EQ(s.resample(10, aggregator::last).data[2], 4);
+    auto first = s.resample(10, aggregator::first);
+    ASSERT_EQ(first.data[2], 2);
+    ASSERT_TRUE(std::isnan(first.data[3]));
+
+    s.toColumnar();
+    auto colMean = s.resample(20, aggregator::mean);
+    ASSERT_TRUE(colMean.isColumnar());
+    ASSERT_EQ(colMean.timeVector(), (std::vector<int64_t>{-20, 0, 20}));
+    ASSERT_EQ(colMean.at(1, 0), 3.5f);
+    ASSERT_EQ(colMean.at(1, 1), 40.f);
+
+    ASSERT_THROW(s.resample(0, aggregator::mean), std::runtime_error);
+}
+
+
+TEST(InfluxDBSeries, rolling) {
+    using namespace influxdb;
+
+    std::mt19937 rng{7};
+    series s;
+    s.columns = {"time", "a", "b"};
+    s.dataStride = 2;
+    s.num = 500;
+    auto &time(s.getTimeVector());
+    for (size_t i = 0; i < s.num; ++i) time.push_back(1000 + static_cast<int64_t>(i) * 10 + (rng() % 3 ? 0 : 5));
+    for (size_t i = 0; i < s.num * 2; ++i) s.data.push_back(rng() % 10 ? static_cast<float>(rng() % 100) : NAN);
+
+    // naive O(n*w) reference
+    auto reference = [&](window_fn fn, window_size w, size_t r, size_t c) {
+        std::vector<double> v;
+        for (size_t j = 0; j <= r; ++j) {
+            bool in = w.rows ? r - j < w.rows : s.t(j) > s.t(r) - w.duration;
+            if (in && !std::isnan(s.at(j, c))) v.push_back(s.at(j, c));
+        }
+        if (v.empty() || (fn == window_fn::stddev && v.size() < 2)) return NAN;
+        double sum = std::accumulate(v.begin(), v.end(), 0.), mean = sum / v.size();
+        switch (fn) {
+            case window_fn::sum: return float(sum);
+            case window_fn::mean: return float(mean);
+            case window_fn::min: return float(*std::min_element(v.begin(), v.end()));
+            case window_fn::max: return float(*std::max_element(v.begin(), v.end()));
+            case window_fn::stddev: {
+                double sq = 0;
+                for (auto x : v) sq += (x - mean) * (x - mean);
+                return float(std::sqrt(sq / (v.size() - 1)));
+            }
+        }
+        return NAN;
+    };
+
+    for (auto w : {window_size::byCount(1), window_size::byCount(7), window_size::byTime(45)}) {
+        for (auto fn : {window_fn::sum, window_fn::mean, window_fn::min, window_fn::max, window_fn::stddev}) {
+            auto r = s.rolling(fn, w);
+            r.checkNum();
+            ASSERT_EQ(r.num, s.num);
+            for (size_t i = 0; i < s.num; ++i) {
+                ASSERT_EQ(r.t(i), s.t(i));
+                for (size_t c = 0; c < 2; ++c) {
+                    auto expected = reference(fn, w, i, c);
+                    if (std::isnan(expected)) ASSERT_TRUE(std::isnan(r.at(i, c))) << i;
+                    else ASSERT_NEAR(r.at(i, c), expected, 1e-3) << i;
+                }
+            }
+        }
+    }
+
+    // incremental: a live tail growing in steps gives the same result
+    auto full = s.rolling(window_fn::max, window_size::byTime(45));
+    series tail, out;
+    tail.columns = s.columns;
+    tail.dataStride = 2;
+    rolling_window rw(window_fn::max, window_size::byTime(45), 2);
+    for (size_t end = 0; end < s.num;) {
+        auto next = std::min(s.num, end + 1 + rng() % 50);
+        for (; end < next; ++end) {
+            tail.getTimeVector().push_back(s.t(end));
+            tail.data.push_back(s.at(end, 0));
+            tail.data.push_back(s.at(end, 1));
+            ++tail.num;
+        }
+        ASSERT_GT(rw.update(tail, out), 0);
+    }
+    ASSERT_EQ(out.timeVector(), full.timeVector());
+    for (size_t i = 0; i < full.data.size(); ++i)
+        ASSERT_TRUE(out.data[i] == full.data[i] || (std::isnan(out.data[i]) && std::isnan(full.data[i])));
+}
+
+
+TEST(InfluxDBSeries, view) {
+    using namespace influxdb;
+
+    series s;
+    s.columns = {"time", "a", "b"};
+    s.dataStride = 2;
+    s.num = 100;
+    for (size_t i = 0; i < s.num; ++i) {
+        s.getTimeVector().push_back(1000 + static_cast<int64_t>(i) * 10);
+        s.data.push_back(static_cast<float>(i));
+        s.data.push_back(static_cast<float>(i) * 2);
+    }
+
+    auto v = s.slice(1095, 1200);
+    ASSERT_EQ(v.num, 10);
+    ASSERT_EQ(v.t(0), 1100);
+    ASSERT_EQ(v.t(9), 1190);
+    ASSERT_EQ(v.at(0, 1), 20.f);
+    ASSERT_EQ(v.row(0), &s.data[20]); // no copy
+    ASSERT_EQ(v.column(1)[2], 24.f);
+
+    ASSERT_EQ(s.slice(0, 1000).num, 0);
+    ASSERT_EQ(s.slice(0, 1001).num, 1);
+    ASSERT_EQ(s.slice(1990, 5000).num, 1);
+    ASSERT_EQ(s.slice(1500, 1200).num, 0);
+    ASSERT_EQ(v.slice(1150, 1160).t(0), 1150);
+    ASSERT_THROW(v.rows(5, 6), std::out_of_range);
+
+    auto copy = v.toSeries();
+    copy.checkNum();
+    ASSERT_EQ(copy.t(0), 1100);
+    ASSERT_EQ(copy.data.size(), 20);
+    ASSERT_EQ(copy.data[19], 38.f);
+
+    // read-only operations on views
+    ASSERT_EQ(v.resample(50, aggregator::sum).data, copy.resample(50, aggregator::sum).data);
+    ASSERT_EQ(v.rolling(window_fn::max, window_size::byCount(3)).data,
+              copy.rolling(window_fn::max, window_size::byCount(3)).data);
+    auto joined = series::join({v, s.slice(1150, 2000)}, join_mode::inner);
+    ASSERT_EQ(joined.num, 5);
+    ASSERT_EQ(joined.t(0), 1150);
+
+    // compact time and columnar layout
+    s.compactTime();
+    s.toColumnar();
+    auto cv = s.slice(1095, 1200);
+    ASSERT_EQ(cv.num, 10);
+    ASSERT_EQ(cv.at(0, 1), 20.f);
+    ASSERT_TRUE(cv.column(0).contiguous());
+    auto ccopy = cv.toSeries();
+    ASSERT_TRUE(ccopy.tIsCompact());
+    ASSERT_TRUE(ccopy.isColumnar());
+    ASSERT_EQ(ccopy.at(9, 1), 38.f);
+}
+
+
+TEST(InfluxDBSeries, tagDict) {
+    using namespace influxdb;
+
+    tag_dict dict;
+    auto host = dict.intern("host"), region = dict.intern("region");
+    ASSERT_EQ(dict.intern(std::string("host")), host);
+    ASSERT_NE(host, region);
+    ASSERT_EQ(dict.str(region), "region");
+
+    // same tags in another order give equal ids
+    tag_ids a{region, dict.intern("eu"), host, dict.intern("a1")};
+    tag_ids b{host, dict.intern("a1"), region, dict.intern("eu")};
+    tag_dict::normalize(a);
+    tag_dict::normalize(b);
+    ASSERT_EQ(a, b);
+    ASSERT_EQ(tag_ids_hash{}(a), tag_ids_hash{}(b));
+    ASSERT_EQ(dict.size(), 4);
+
+    auto tags = dict.tags(a);
+    ASSERT_EQ(tags.size(), 2);
+    ASSERT_EQ(tags["host"], "a1");
+    ASSERT_EQ(tags["region"], "eu");
+
+    // concurrent interning hands out one id per string
+    std::vector<std::thread> threads;
+    std::vector<std::vector<uint32_t>> ids(4);
+    for (size_t t = 0; t < ids.size(); ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 1000; ++i) ids[t].push_back(dict.intern("host" + std::to_string(i)));
+        });
+    }
+    for (auto &th : threads) th.join();
+    for (auto &v : ids) ASSERT_EQ(v, ids[0]);
+    ASSERT_EQ(dict.size(), 4 + 1000);
+}
+
+
+TEST(InfluxDBSeries, fileCache) {
+    using namespace influxdb;
+
+    auto dir = testing::TempDir() + "influx-cache-test-"
+               + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    file_cache<series> cache(dir);
+
+    series s;
+    s.columns = {"time", "a", "b"};
+    s.dataStride = 2;
+    s.num = 3;
+    s.getTimeVector() = {1000, 2000, 3000};
+    s.data = {1, 2, 3, 4, 5, 6};
+    s.compactTime();
+
+    ASSERT_FALSE(cache.have("SELECT 1"));
+    cache.set("SELECT 1", s);
+    ASSERT_TRUE(cache.have("SELECT 1"));
+    cache.set("SELECT 1", s); // replaces
+
+    series r;
+    ASSERT_TRUE(cache.get("SELECT 1", r));
+    r.checkNum();
+    ASSERT_EQ(r.columns, s.columns);
+    ASSERT_EQ(r.timeVector(), (std::vector<int64_t>{1000, 2000, 3000}));
+    ASSERT_EQ(r.data, s.data);
+    ASSERT_FALSE(cache.get("SELECT 2", r));
+
+    // grouped batches keep their tags, interned into the reading dictionary
+    tag_dict writeDict, readDict;
+    std::vector<series> batch(2, s);
+    batch[0].tagIds = {writeDict.intern("host"), writeDict.intern("a")};
+    batch[1].tagIds = {writeDict.intern("host"), writeDict.intern("b")};
+    file_cache<grouped_batch> groupCache(dir, true); // gorilla encoded
+    groupCache.set("SELECT 3", grouped_batch{batch, writeDict});
+
+    readDict.intern("x");
+    std::vector<series> readBatch;
+    grouped_batch rb{readBatch, readDict};
+    ASSERT_TRUE(groupCache.get("SELECT 3", rb));
+    ASSERT_EQ(readBatch.size(), 2);
+    ASSERT_EQ(readDict.tags(readBatch[1].tagIds).at("host"), "b");
+    ASSERT_EQ(readBatch[1].data, s.data);
+}
+
+
+TEST(InfluxDBSeries, cacheIndex) {
+    using namespace influxdb;
+
+    auto dir = testing::TempDir() + "influx-index-test-"
+               + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    series s;
+    s.columns = {"time", "v"};
+    s.dataStride = 1;
+    s.num = 2;
+    s.getTimeVector() = {1000, 2000};
+    s.data = {1, 2};
+
+    file_cache<series> cache(dir);
+    for (int i = 0; i < 10; ++i) cache.set("SELECT " + std::to_string(i), s);
+    cache.set("SELECT 0", s); // replaces
+    ASSERT_EQ(cache.index->size(), 10);
+    ASSERT_GT(cache.index->bytes(), 10 * sizeof(series_file_header));
+    ASSERT_EQ(file_cache<series>(dir).index, cache.index); // shared within the process
+
+    // another process: loads the manifest, sees later writes after a refresh
+    cache_index other(dir);
+    ASSERT_EQ(other.size(), 10);
+    ASSERT_EQ(other.bytes(), cache.index->bytes());
+    cache.set("SELECT 10", s);
+    ASSERT_EQ(other.size(), 10);
+    other.refresh();
+    ASSERT_EQ(other.size(), 11);
+
+    series r;
+    ASSERT_TRUE(cache.get("SELECT 3", r));
+    ASSERT_EQ(r.data, s.data);
+    ASSERT_FALSE(cache.get("SELECT 11", r));
+    ASSERT_FALSE(cache.have("SELECT 11"));
+
+    auto fp = ::util::Fingerprint128(std::string("SELECT 3"));
+    cache_index::entry e{};
+    ASSERT_TRUE(cache.index->find({fp.first, fp.second}, e));
+    ASSERT_EQ(e.size * 11, cache.index->bytes());
+    cache.index->remove({fp.first, fp.second});
+    ASSERT_FALSE(cache.have("SELECT 3"));
+    other.refresh();
+    ASSERT_EQ(other.size(), 10);
+    ASSERT_EQ(cache_index(dir).size(), 10);
+
+    // a manifest rewritten by another process: later appends go to the new file, not the replaced one
+    for (int i = 0; i < 1100; ++i) cache.set("SELECT 0", s);
+    cache_index rewritten(dir); // mostly superseded records, rewritten on open
+    ASSERT_EQ(rewritten.size(), 10);
+    cache.set("SELECT 12", s);
+    ASSERT_EQ(cache_index(dir).size(), 11);
+}
+
+
+TEST(InfluxDBSeries, cacheLimits) {
+    using namespace influxdb;
+
+    auto dir = testing::TempDir() + "influx-limits-test-"
+               + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    series s;
+    s.columns = {"time", "v"};
+    s.dataStride = 1;
+    s.num = 100;
+    for (size_t i = 0; i < s.num; ++i) s.getTimeVector().push_back(static_cast<int64_t>(i) * 1000), s.data.push_back(i);
+
+    file_cache<series> cache(dir, true);
+    auto key = [](int q, int i) { return "SELECT " + std::to_string(q) + " batch " + std::to_string(i); };
+    for (int i = 0; i < 20; ++i) cache.set(key(1, i), s, 1);
+    for (int i = 0; i < 4; ++i) cache.set(key(2, i), s, 2);
+    auto location = [&](const std::string &k) {
+        auto fp = ::util::Fingerprint128(k);
+        cache_index::entry e{};
+        EXPECT_TRUE(cache.index->find({fp.first, fp.second}, e));
+        return e;
+    };
+
+    // the batches of query 1 are packed into a segment, too few of query 2
+    cache.index->setLimits(cache_limits{0, cache_eviction::lru, true});
+    cache.index->maintain();
+    auto seg = location(key(1, 0));
+    ASSERT_NE(seg.segment, 0);
+    ASSERT_EQ(location(key(1, 19)).segment, seg.segment);
+    ASSERT_EQ(location(key(2, 0)).segment, 0);
+    auto segFile = cache.index->path({0, 0}, seg);
+    ASSERT_TRUE(std::ifstream(segFile).good());
+    ASSERT_EQ(cache.index->size(), 24);
+    for (int i = 0; i < 20; ++i) {
+        series r;
+        ASSERT_TRUE(cache.get(key(1, i), r));
+        ASSERT_EQ(r.data, s.data);
+        auto m = cache.map(key(1, i));
+        ASSERT_TRUE(m);
+        ASSERT_EQ(m->view().t(99), 99000);
+    }
+    cache_index other(dir);
+    auto fp = ::util::Fingerprint128(key(1, 5));
+    cache_index::entry e{};
+    ASSERT_TRUE(other.find({fp.first, fp.second}, e));
+    ASSERT_EQ(e.segment, seg.segment);
+
+    // over budget, the least recently read file goes first: the whole segment
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    for (int i = 0; i < 4; ++i) ASSERT_TRUE(cache.have(key(2, i)));
+    ASSERT_GT(cache.index->diskBytes(), cache.index->bytes()); // the manifest and segment padding count too
+    auto budget = cache.index->diskBytes() / 2;
+    cache.index->setLimits(cache_limits{budget, cache_eviction::lru, true});
+    for (int i = 0; i < 500 && (cache.index->diskBytes() > budget || std::ifstream(segFile).good()); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_LE(cache.index->diskBytes(), budget);
+    ASSERT_FALSE(cache.have(key(1, 3)));
+    ASSERT_TRUE(cache.have(key(2, 3)));
+    ASSERT_FALSE(std::ifstream(segFile).good());
+
+    // stopped explicitly, a later setLimits() starts it again
+    cache.index->stop();
+    cache.index->stop();
+    cache.index->setLimits(cache_limits{budget, cache_eviction::lfu, true});
+    cache.index->stop();
+}
+
+
+TEST(InfluxDBSeries, binaryFormat) {
+    using namespace influxdb;
+
+    series s;
+    s.name = "load";
+    s.tags = {{"host", "a1"}};
+    s.columns = {"time", "a", "b"};
+    s.dataStride = 2;
+    s.num = 100;
+    for (size_t i = 0; i < s.num; ++i) {
+        s.getTimeVector().push_back(1000 + static_cast<int64_t>(i) * 10 + (i == 50 ? 3 : 0));
+        s.data.push_back(static_cast<float>(i));
+        s.data.push_back(i % 7 ? static_cast<float>(i) / 2 : NAN);
+    }
+
+    auto expectSame = [&](const series_view &v) {
+        ASSERT_EQ(v.num, s.num);
+        ASSERT_EQ(v.columns(), s.columns);
+        ASSERT_EQ(v.src->name, "load");
+        ASSERT_EQ(v.src->tags.at("host"), "a1");
+        for (size_t i = 0; i < s.num; ++i) {
+            ASSERT_EQ(v.t(i), s.t(i));
+            ASSERT_EQ(v.at(i, 0), s.at(i, 0));
+            ASSERT_TRUE(v.at(i, 1) == s.at(i, 1) || (std::isnan(v.at(i, 1)) && std::isnan(s.at(i, 1))));
+        }
+    };
+
+    auto dir = testing::TempDir();
+    auto path = dir + "influx-series-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    for (int layout = 0; layout < 3; ++layout) {
+        if (layout == 1) s.toColumnar();
+        if (layout == 2) s.compactTime(); // segmented grid, stored dense
+
+        std::stringstream ss;
+        ss << s;
+        auto bytes = ss.str();
+        ASSERT_EQ(bytes.size() % 4, 0);
+
+        series read;
+        ss >> read;
+        read.checkNum();
+        ASSERT_EQ(read.isColumnar(), s.isColumnar());
+        expectSame(read);
+
+        {
+            std::ofstream f(path, std::ios::binary);
+            f << s;
+        }
+        mapped_series m(path);
+        expectSame(m.view());
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(m.view().data) % series_file_header::Align, 0);
+        expectSame(m.view().toSeries());
+        ASSERT_EQ(m.view().slice(1200, 1300).num, 10);
+        expectSame(m.release());
+
+        // a flipped bit is detected
+        bytes[bytes.size() - 5] ^= 1;
+        std::stringstream corrupt(bytes);
+        ASSERT_THROW(corrupt >> read, std::runtime_error);
+    }
+
+    // compact time without segments is stored as start + interval
+    series c;
+    c.columns = {"time", "v"};
+    c.dataStride = 1;
+    c.num = 64;
+    for (size_t i = 0; i < c.num; ++i) c.getTimeVector().push_back(static_cast<int64_t>(i) * 1000), c.data.push_back(1);
+    ASSERT_TRUE(c.compactTime());
+    {
+        std::ofstream f(path, std::ios::binary);
+        f << c;
+    }
+    mapped_series mc(path);
+    ASSERT_EQ(mc.view().time, nullptr);
+    ASSERT_EQ(mc.view().t(63), 63000);
+    ASSERT_TRUE(mc.view().toSeries().tIsCompact());
+    ASSERT_TRUE(mc.inPlace());
+
+    // mapped rows are appended straight from the file, compact time continues the grid
+    series appended;
+    appended.append(mc.view());
+    ASSERT_EQ(appended.num, 64);
+    ASSERT_TRUE(appended.tIsCompact());
+    ASSERT_THROW(appended.append(mc.view()), std::logic_error);
+    series next = c;
+    for (auto &t : next.getTimeVector()) t += 64000;
+    next.compactTime();
+    appended.append(series_view(next));
+    appended.append(mc.view().rows(0, 0));
+    appended.checkNum();
+    ASSERT_EQ(appended.num, 128);
+    ASSERT_TRUE(appended.tIsCompact());
+    ASSERT_EQ(appended.t(127), 127000);
+    ASSERT_EQ(appended.data, std::vector<float>(128, 1));
+
+    std::stringstream garbage("not a series file at all, not a series file at all, not a series file at all");
+    series g;
+    ASSERT_THROW(garbage >> g, std::runtime_error);
+    std::remove(path.c_str());
+}
+
+
+TEST(InfluxDBSeries, gorilla) {
+    using namespace influxdb;
+
+    // jittered time, repeated values, slow drift, NaN and a large jump
+    series s;
+    s.name = "load";
+    s.columns = {"time", "a", "b", "c"};
+    s.dataStride = 3;
+    s.num = 1000;
+    std::mt19937 rng(7);
+    for (size_t i = 0; i < s.num; ++i) {
+        s.getTimeVector().push_back(1000 * static_cast<int64_t>(i) + (i % 50 == 0 ? rng() % 100 : 0)
+                                    + (i > 900 ? 1000000000000ll : 0));
+        s.data.push_back(static_cast<float>(i / 10));
+        s.data.push_back(20.f + static_cast<float>(rng() % 1000) / 100);
+        s.data.push_back(i % 13 ? -1e30f * static_cast<float>(i) : NAN);
+    }
+
+    auto sameBits = [](float a, float b) { return std::memcmp(&a, &b, 4) == 0; };
+    for (bool columnar : {false, true}) {
+        if (columnar) s.toColumnar();
+        std::string enc;
+        gorilla::encode(s, enc);
+        std::vector<int64_t> time(s.num);
+        std::vector<float> data(s.num * s.dataStride);
+        gorilla::decode(enc.data(), enc.size(), s.num, s.dataStride, time.data(), data.data(), columnar);
+        ASSERT_EQ(time, s.timeVector());
+        for (size_t i = 0; i < data.size(); ++i) ASSERT_TRUE(sameBits(data[i], s.data[i])) << i;
+        ASSERT_THROW(gorilla::decode(enc.data(), enc.size() / 2, s.num, s.dataStride, time.data(), data.data(),
+                                     columnar), std::runtime_error);
+    }
+
+    // regularly sampled, slowly changing data compresses well, also through the file format
+    series r;
+    r.columns = {"time", "v"};
+    r.dataStride = 1;
+    r.num = 10000;
+    for (size_t i = 0; i < r.num; ++i) {
+        r.getTimeVector().push_back(static_cast<int64_t>(i) * 1000);
+        r.data.push_back(static_cast<float>(i / 100) * 0.5f);
+    }
+    ASSERT_TRUE(r.compactTime());
+    std::stringstream raw, packed;
+    writeSeries(raw, r);
+    writeSeries(packed, r, true);
+    ASSERT_GT(raw.str().size(), 10 * packed.str().size());
+
+    series read;
+    packed >> read;
+    read.checkNum();
+    ASSERT_TRUE(read.tIsCompact());
+    ASSERT_EQ(read.t(9999), 9999000);
+    ASSERT_EQ(read.data, r.data);
+
+    auto path = testing::TempDir() + "influx-gorilla-"
+                + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream f(path, std::ios::binary);
+        writeSeries(f, s, true);
+    }
+    mapped_series m(path);
+    ASSERT_FALSE(m.inPlace());
+    ASSERT_TRUE(m.view().isColumnar());
+    ASSERT_EQ(m.view().t(950), s.t(950));
+    ASSERT_TRUE(sameBits(m.view().at(950, 1), s.at(950, 1)));
+    // the decoded series is moved out, not copied
+    auto p = m.view().data;
+    auto released = m.release();
+    ASSERT_EQ(released.data.data(), p);
+    ASSERT_EQ(released.num, s.num);
+    ASSERT_EQ(m.view().num, 0);
+    std::remove(path.c_str());
+
+    auto bytes = packed.str();
+    bytes[bytes.size() - 20] ^= 1;
+    std::stringstream corrupt(bytes);
+    ASSERT_THROW(corrupt >> read, std::runtime_error);
+}
+
+
+TEST(InfluxDBSeries, sortedMerge) {
+    using namespace influxdb;
+
+    const std::vector<std::string> ab{"time", "a", "b"};
+
+    std::vector<series> batches;
+    batches.push_back(makeSeries(ab, {300, 400}, {NAN, 3.f, 4.f, 4.f}));
+    batches.push_back(makeSeries(ab, {100, 200}, {1.f, NAN, 2.f, NAN}));
+    batches.push_back(makeSeries(ab, {}, {}));
+
+    auto m = series::sortedMerge(batches);
+    m.checkNum();
+    ASSERT_EQ(m.num, 4);
+    ASSERT_EQ(m.timeVector(), (std::vector<int64_t>{100, 200, 300, 400}));
+    ASSERT_TRUE(std::isnan(m.data[1]));
+    ASSERT_TRUE(std::isnan(m.data[3]));
+    ASSERT_EQ(m.data[4], 2.f); // NaN at the start of a batch is filled with previous
+    ASSERT_EQ(m.data[5], 3.f);
+
+    // an empty series takes the buffers of the first batch, later ones are copied
+    series merged;
+    auto b0 = makeSeries(ab, {100}, {1.f, 1.f});
+    auto p0 = b0.data.data();
+    merged.append(std::move(b0));
+    ASSERT_EQ(merged.data.data(), p0);
+    merged.append(makeSeries(ab, {200}, {NAN, 2.f}));
+    ASSERT_EQ(merged.num, 2);
+    ASSERT_EQ(merged.data, (std::vector<float>{1.f, 1.f, 1.f, 2.f}));
+    ASSERT_THROW(merged.append(makeSeries(ab, {200}, {3.f, 3.f})), std::logic_error);
+
+    // appends within the reserved rows do not reallocate
+    merged.reserve(10);
+    ASSERT_GE(merged.capacity(), 10);
+    auto p1 = merged.data.data();
+    for (int64_t t = 300; t < 1100; t += 100) merged.append(makeSeries(ab, {t}, {1.f, 2.f}));
+    ASSERT_EQ(merged.num, 10);
+    ASSERT_EQ(merged.data.data(), p1);
+
+    // columnar inputs are concatenated row-major and transposed once
+    std::vector<series> cols;
+    cols.push_back(makeSeries(ab, {300, 400}, {NAN, 3.f, 4.f, 4.f}));
+    cols.push_back(makeSeries(ab, {100, 200}, {1.f, NAN, 2.f, NAN}));
+    for (auto &c : cols) c.toColumnar();
+    auto mc = series::sortedMerge(cols);
+    ASSERT_TRUE(mc.isColumnar());
+    mc.toRowMajor();
+    ASSERT_EQ(mc.timeVector(), m.timeVector());
+    for (size_t i = 0; i < m.data.size(); ++i)
+        ASSERT_TRUE(mc.data[i] == m.data[i] || (std::isnan(mc.data[i]) && std::isnan(m.data[i])));
+
+    // a columnar append grows every column in place
+    series ca = makeSeries(ab, {100, 200}, {1.f, 2.f, 3.f, 4.f});
+    ca.toColumnar();
+    auto cb = makeSeries(ab, {300}, {5.f, 6.f});
+    cb.toColumnar();
+    ca.append(std::move(cb));
+    ASSERT_TRUE(ca.isColumnar());
+    ASSERT_EQ(ca.data, (std::vector<float>{1.f, 3.f, 5.f, 2.f, 4.f, 6.f}));
+}
+
+
+TEST(InfluxDBSeries, sortedMergeOverlapping) {
+    using namespace influxdb;
+
+    const std::vector<std::string> ab{"time", "a", "b"};
+    auto inputs = [&]() {
+        std::vector<series> batches;
+        batches.push_back(makeSeries(ab, {100, 200, 300}, {1, 1, 2, NAN, 3, 3}));
+        batches.push_back(makeSeries(ab, {200, 300, 400, 500}, {20, 20, 30, 30, 40, 40, 50, 50}));
+        batches.push_back(makeSeries(ab, {50, 300}, {0.5f, 0.5f, 300, 300}));
+        return batches;
+    };
+
+    auto b0 = inputs();
+    auto first = series::sortedMerge(b0, dedup_policy::first);
+    first.checkNum();
+    ASSERT_EQ(first.timeVector(), (std::vector<int64_t>{50, 100, 200, 300, 400, 500}));
+    ASSERT_EQ(first.data, (std::vector<float>{0.5f, 0.5f, 1, 1, 2, 1, 3, 3, 40, 40, 50, 50}));
+
+    auto b1 = inputs();
+    auto last = series::sortedMerge(b1, dedup_policy::last);
+    ASSERT_EQ(last.data, (std::vector<float>{0.5f, 0.5f, 1, 1, 20, 20, 300, 300, 40, 40, 50, 50}));
+
+    auto b2 = inputs();
+    auto valid = series::sortedMerge(b2, dedup_policy::preferValid);
+    ASSERT_EQ(valid.data, (std::vector<float>{0.5f, 0.5f, 1, 1, 2, 20, 3, 3, 40, 40, 50, 50}));
+
+    // the result has the layout of the earliest input, as concatenated results do
+    auto b3 = inputs();
+    for (auto &b : b3) b.toColumnar();
+    auto columnar = series::sortedMerge(b3, dedup_policy::first);
+    columnar.checkNum();
+    ASSERT_TRUE(columnar.isColumnar());
+    ASSERT_EQ(columnar.data, (std::vector<float>{0.5f, 1, 2, 3, 40, 50, 0.5f, 1, 1, 3, 40, 50}));
+}
+
+
 TEST(InfluxDB, trim) {
     using namespace influxdb;
     using namespace influxdb::util;
@@ -194,4 +1136,77 @@ TEST(InfluxDB, trim) {
 
     ASSERT_EQ(s0.num, 8);
     ASSERT_NEAR(s0.data[0], 0.23, 1e-7);
-}
\ No newline at end of file
+}
+
+TEST(InfluxDBAdmission, queue) {
+    using namespace influxdb;
+
+    admission_queue q{2, 4};
+    int started = 0;
+    for (int i = 0; i < 4; ++i) q.submit([&started]() { ++started; });
+
+    ASSERT_EQ(started, 2);
+    ASSERT_EQ(q.numPending(), 2);
+    ASSERT_EQ(q.numQueued(), 2);
+    ASSERT_THROW(for (int i = 0; i < 3; ++i) q.submit([]() {}), std::runtime_error);
+
+    q.release();
+    ASSERT_EQ(started, 3);
+    ASSERT_EQ(q.numPending(), 2);
+
+    while (q.numPending() > 0) q.release();
+    ASSERT_EQ(started, 4);
+    ASSERT_EQ(q.numQueued(), 0);
+
+    // a global slot freed by one queue dispatches another queue's request, which may finish right away
+    admission_queue::setGlobalLimit(1);
+    admission_queue a{1, 4}, b{1, 4};
+    a.submit([]() {});
+    bool ranB = false;
+    b.submit([&]() {
+        ranB = true;
+        b.release(); // re-enters release() on the dispatching thread
+    });
+    ASSERT_FALSE(ranB);
+    a.release();
+    ASSERT_TRUE(ranB);
+    ASSERT_EQ(b.numPending(), 0);
+    admission_queue::setGlobalLimit(0);
+
+    // requests still queued are rejected when the queue goes away
+    int rejected = 0;
+    {
+        admission_queue d{1, 4};
+        for (int i = 0; i < 3; ++i)
+            d.submit([]() {}, [&rejected](std::exception_ptr e) {
+                ASSERT_THROW(std::rethrow_exception(e), std::runtime_error);
+                ++rejected;
+            });
+    }
+    ASSERT_EQ(rejected, 2);
+}
+
+
+TEST(InfluxDBRetry, circuitBreaker) {
+    using namespace influxdb;
+
+    circuit_breaker cb{3, 50ms};
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(cb.allow());
+        cb.failure();
+    }
+    ASSERT_TRUE(cb.isOpen());
+    ASSERT_FALSE(cb.allow());
+
+    std::this_thread::sleep_for(60ms);
+    ASSERT_TRUE(cb.allow()); // probe
+    ASSERT_FALSE(cb.allow());
+    cb.success();
+    ASSERT_TRUE(cb.allow());
+
+    for (int r = 0; r < MaxRetries; ++r) {
+        auto d = retryDelay(r);
+        ASSERT_GE(d, RetryBaseDelay * (1 << r) / 2);
+        ASSERT_LE(d, RetryBaseDelay * (1 << r));
+    }
+}